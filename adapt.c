@@ -0,0 +1,215 @@
+/*
+ *  adapt module
+ *  Adaptive scaling of the producer and consumer pools
+ *
+ *  Every producer and consumer thread is started, but a controller thread
+ *  decides how many of each may run.  It samples buffer occupancy and the
+ *  number of workers blocked on the buffer, and once per window:
+ *  - parks a worker on a side whose workers spent a whole worker's worth
+ *    of the window blocked, that side has capacity to spare
+ *  - otherwise unparks a worker on a side the occupancy says is falling
+ *    behind (buffer nearly empty for producers, nearly full for consumers)
+ *  so the pipeline settles on the fewest workers that keep it moving.
+ *
+ *  Workers park only between buffer operations, never holding matrices.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "element.h"
+#include "matrix.h"
+#include "counter.h"
+#include "ring.h"
+#include "steal.h"
+#include "match.h"
+#include "lanes.h"
+#include "adapt.h"
+#include "pcmatrix.h"
+#include "prodcons.h"
+
+static pthread_t controller;
+static _Atomic int controller_stop;
+static counter_t claimed; // matrices claimed by adaptive producers
+static AdaptStats adapt_result;
+
+static void gate_init(WorkerGate * g, int total)
+{
+  pthread_mutex_init(&g->lock, NULL);
+  pthread_cond_init(&g->cv, NULL);
+  g->total = total;
+  atomic_init(&g->active, total);
+  atomic_init(&g->open, 0);
+  init_cnt(&g->waiting);
+}
+
+static void gate_destroy(WorkerGate * g)
+{
+  pthread_mutex_destroy(&g->lock);
+  pthread_cond_destroy(&g->cv);
+}
+
+// let n workers on this side run, waking any that were parked
+static void gate_set(WorkerGate * g, int n)
+{
+  pthread_mutex_lock(&g->lock);
+  atomic_store(&g->active, n);
+  pthread_cond_broadcast(&g->cv);
+  pthread_mutex_unlock(&g->lock);
+}
+
+// Park worker id while it is not among the active workers on its side
+void adapt_wait(WorkerGate * g, int id)
+{
+  if (!ADAPTIVE)
+    return;
+  if (id < atomic_load_explicit(&g->active, memory_order_relaxed) || atomic_load_explicit(&g->open, memory_order_relaxed))
+    return;
+  pthread_mutex_lock(&g->lock);
+  while (id >= atomic_load(&g->active) && !atomic_load(&g->open))
+    pthread_cond_wait(&g->cv, &g->lock);
+  pthread_mutex_unlock(&g->lock);
+}
+
+// Whether adapt_wait() would park worker id right now, so it can let go
+// of anything it holds first
+int adapt_parking(WorkerGate * g, int id)
+{
+  return ADAPTIVE && id >= atomic_load_explicit(&g->active, memory_order_relaxed)
+         && !atomic_load_explicit(&g->open, memory_order_relaxed);
+}
+
+// This side has run out of work, parked workers must wake up to exit
+void adapt_open(WorkerGate * g)
+{
+  if (!ADAPTIVE)
+    return;
+  pthread_mutex_lock(&g->lock);
+  atomic_store(&g->open, 1);
+  pthread_cond_broadcast(&g->cv);
+  pthread_mutex_unlock(&g->lock);
+}
+
+// Claim the next chunk of matrices for an adaptive producer
+// Returns the chunk number and sets n to its size, or -1 once every
+// matrix has been claimed
+int adapt_claim(int * n)
+{
+  int start = fetch_add_cnt(&claimed, ADAPT_CHUNK);
+  if (start >= NUMBER_OF_MATRICES) {
+    adapt_open(&prodgate); // nothing left for parked producers either
+    return -1;
+  }
+  *n = NUMBER_OF_MATRICES - start < ADAPT_CHUNK ? NUMBER_OF_MATRICES - start : ADAPT_CHUNK;
+  return start / ADAPT_CHUNK;
+}
+
+// number of matrices in the buffer right now
+static int adapt_occupancy()
+{
+  if (BUFFER_MODE == BUFFER_MODE_RING)
+    return ring_count(bigring); // conc counts reservations, not matrices taken
+  if (BUFFER_MODE == BUFFER_MODE_STEAL)
+    return steal_count(bigsteal);
+  if (BUFFER_MODE == BUFFER_MODE_LANES)
+    return lanes_count(biglanes); // conc counts reservations here too
+  return get_cnt(prodc) - get_cnt(conc);
+}
+
+// number of workers on each side blocked on the buffer right now
+static void adapt_blocked(int * producers, int * consumers)
+{
+  if (BUFFER_MODE == BUFFER_MODE_RING) {
+    *producers = atomic_load_explicit(&bigring->waiting_producers, memory_order_relaxed);
+    *consumers = atomic_load_explicit(&bigring->waiting_consumers, memory_order_relaxed);
+  }
+  else if (BUFFER_MODE == BUFFER_MODE_STEAL) {
+    *producers = steal_waiting_producers(bigsteal);
+    *consumers = atomic_load_explicit(&bigsteal->waiting_consumers, memory_order_relaxed);
+  }
+  else if (BUFFER_MODE == BUFFER_MODE_LANES)
+    lanes_blocked(biglanes, producers, consumers);
+  else {
+    *producers = get_cnt(&prodgate.waiting);
+    *consumers = get_cnt(&consgate.waiting);
+  }
+}
+
+// Scale one side: park a worker if the side was blocked a whole worker's
+// worth of the window, else unpark one if the side is falling behind
+static int adapt_side(WorkerGate * g, int blocked, int behind)
+{
+  int active = atomic_load(&g->active);
+  if (blocked >= ADAPT_WINDOW && active > 1) {
+    gate_set(g, active - 1);
+    return 1;
+  }
+  if (blocked == 0 && behind && active < g->total) {
+    gate_set(g, active + 1);
+    return 1;
+  }
+  return 0;
+}
+
+static void *adapt_controller(void *arg)
+{
+  long samples = 0, prod_sum = 0, cons_sum = 0;
+  int occupied = 0, prod_blocked = 0, cons_blocked = 0, n = 0;
+  while (!atomic_load(&controller_stop)) {
+    usleep(ADAPT_INTERVAL_US);
+    int p, c;
+    adapt_blocked(&p, &c);
+    occupied += adapt_occupancy();
+    prod_blocked += p;
+    cons_blocked += c;
+    prod_sum += atomic_load(&prodgate.active);
+    cons_sum += atomic_load(&consgate.active);
+    samples++;
+    if (++n < ADAPT_WINDOW)
+      continue;
+
+    int percent = (int) (100L * occupied / ((long) ADAPT_WINDOW * BOUNDED_BUFFER_SIZE));
+    adapt_result.adjustments += adapt_side(&prodgate, prod_blocked, percent <= ADAPT_LOW);
+    adapt_result.adjustments += adapt_side(&consgate, cons_blocked, percent >= ADAPT_HIGH);
+    occupied = prod_blocked = cons_blocked = n = 0;
+  }
+  adapt_result.mean_producers = samples ? (double) prod_sum / samples : prodgate.total;
+  adapt_result.mean_consumers = samples ? (double) cons_sum / samples : consgate.total;
+  return NULL;
+}
+
+// Set up the gates for a run, and start the controller in adaptive mode
+void adapt_start(int producers, int consumers)
+{
+  gate_init(&prodgate, producers);
+  gate_init(&consgate, consumers);
+  init_cnt(&claimed);
+  adapt_result.adjustments = 0;
+  if (!ADAPTIVE)
+    return;
+  atomic_store(&controller_stop, 0);
+  pthread_create(&controller, NULL, adapt_controller, NULL);
+}
+
+// Stop the controller once every worker has been joined
+void adapt_stop(AdaptStats * stats)
+{
+  if (ADAPTIVE) {
+    atomic_store(&controller_stop, 1);
+    pthread_join(controller, NULL);
+  }
+  else {
+    adapt_result.mean_producers = prodgate.total;
+    adapt_result.mean_consumers = consgate.total;
+  }
+  adapt_result.producers = atomic_load(&prodgate.active);
+  adapt_result.consumers = atomic_load(&consgate.active);
+  *stats = adapt_result;
+  gate_destroy(&prodgate);
+  gate_destroy(&consgate);
+}
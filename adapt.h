@@ -0,0 +1,60 @@
+/*
+ *  adapt header
+ *  Function prototypes, data, and constants for adaptive worker scaling
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Microseconds between two samples of the pipeline
+#define ADAPT_INTERVAL_US 500
+
+// Samples averaged before each scaling decision
+#define ADAPT_WINDOW 4
+
+// Buffer occupancy, in percent, below which producers are falling behind
+// and above which consumers are falling behind
+#define ADAPT_LOW 25
+#define ADAPT_HIGH 75
+
+// Matrices an adaptive producer claims at a time, each chunk is drawn from
+// its own random stream so the results do not depend on which producer ran it
+#define ADAPT_CHUNK 64
+
+// Parking lot for one side of the pipeline
+// Workers with id < active run, the rest park here between buffer operations
+// total   - workers started on this side
+// active  - workers currently allowed to run
+// open    - set once this side has no work left, releases every parked worker
+// waiting - workers currently blocked on the buffer
+typedef struct worker_gate {
+  pthread_mutex_t lock;
+  pthread_cond_t cv;
+  int total;
+  _Atomic int active;
+  _Atomic int open;
+  counter_t waiting;
+} WorkerGate;
+
+WorkerGate prodgate;
+WorkerGate consgate;
+
+// Outcome of one adaptive run
+// adjustments - number of times a worker was parked or unparked
+// producers, consumers - workers active at the end of the run
+// mean_producers, mean_consumers - workers active on average over the run
+typedef struct adapt_stats {
+  int adjustments;
+  int producers;
+  int consumers;
+  double mean_producers;
+  double mean_consumers;
+} AdaptStats;
+
+// adapt methods
+void adapt_start(int producers, int consumers);
+void adapt_stop(AdaptStats *stats);
+void adapt_wait(WorkerGate *g, int id);
+int adapt_parking(WorkerGate *g, int id);
+void adapt_open(WorkerGate *g);
+int adapt_claim(int *n);
@@ -0,0 +1,191 @@
+/*
+ *  affinity module
+ *  Pins worker threads to CPUs and keeps their memory on their NUMA node
+ *
+ *  The CPUs this process may run on are grouped by NUMA node, from
+ *  libnuma when the program is built with it and from sysfs otherwise.
+ *  Producer i and consumer i form a pair that is always placed on one
+ *  node, so matrices are built, multiplied and freed on the same socket:
+ *  - compact fills a node's CPUs with pairs before moving to the next node
+ *  - scatter deals pairs out to the nodes round robin
+ *  - explicit CPU lists pin each side to its list, pairing is up to the user
+ *
+ *  A pinned worker allocates from its own node: fresh matrices are first
+ *  touched there, and the matrix pool keeps a shared free list per node.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include "affinity.h"
+#include "element.h"
+#include "matrix.h"
+#include "pcmatrix.h"
+#if HAVE_LIBNUMA
+#include <numa.h>
+#endif
+
+static int ncpus; // CPUs we may run on
+static int cpus[CPU_SETSIZE]; // those CPUs, grouped by node
+static int cpu_node[CPU_SETSIZE]; // node of every CPU
+static int nnodes;
+static int node_first[AFFINITY_MAX_NODES]; // index in cpus of each node's first CPU
+static int node_ncpus[AFFINITY_MAX_NODES];
+
+static int list_ncpus[2]; // explicit CPU lists, per role
+static int list_cpus[2][CPU_SETSIZE];
+
+static int * plan[2]; // CPU of every worker, per role
+static int plan_size[2];
+
+// Parse a CPU list such as "0-3,8,10-11" into cpus
+// Returns the number of CPUs, -1 if the list is malformed
+int affinity_parse_cpus(const char * list, int * cpus, int max)
+{
+  int n = 0;
+  const char * p = list;
+  while (*p) {
+    char * end;
+    long lo = strtol(p, &end, 10);
+    if (end == p || lo < 0 || lo >= CPU_SETSIZE)
+      return -1;
+    long hi = lo;
+    if (*end == '-') {
+      p = end + 1;
+      hi = strtol(p, &end, 10);
+      if (end == p || hi < lo || hi >= CPU_SETSIZE)
+        return -1;
+    }
+    for (long c = lo; c <= hi && n < max; c++)
+      cpus[n++] = (int) c;
+    if (*end == ',')
+      end++;
+    else if (*end != '\0' && *end != '\n')
+      return -1;
+    p = end;
+  }
+  return n > 0 ? n : -1;
+}
+
+// NUMA node of every CPU, 0 when the system does not say
+static void affinity_nodes_of_cpus()
+{
+  memset(cpu_node, 0, sizeof(cpu_node));
+#if HAVE_LIBNUMA
+  if (numa_available() >= 0) {
+    int n = numa_num_configured_cpus();
+    for (int c = 0; c < n && c < CPU_SETSIZE; c++) {
+      int node = numa_node_of_cpu(c);
+      cpu_node[c] = node < 0 ? 0 : node % AFFINITY_MAX_NODES;
+    }
+    return;
+  }
+#endif
+  // each node lists its CPUs in sysfs
+  for (int node = 0; node < 64; node++) {
+    char path[64], line[4096];
+    int list[CPU_SETSIZE];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE * f = fopen(path, "r");
+    if (f == NULL)
+      continue;
+    int n = fgets(line, sizeof(line), f) ? affinity_parse_cpus(line, list, CPU_SETSIZE) : -1;
+    fclose(f);
+    for (int i = 0; i < n; i++)
+      cpu_node[list[i]] = node % AFFINITY_MAX_NODES;
+  }
+}
+
+// Find the CPUs we may use and group them by node
+// Returns the number of CPUs, 0 if they could not be determined
+int affinity_init()
+{
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    return 0;
+  affinity_nodes_of_cpus();
+  ncpus = 0;
+  nnodes = 0;
+  for (int node = 0; node < AFFINITY_MAX_NODES; node++) {
+    node_first[nnodes] = ncpus;
+    for (int c = 0; c < CPU_SETSIZE; c++)
+      if (CPU_ISSET(c, &allowed) && cpu_node[c] == node)
+        cpus[ncpus++] = c;
+    node_ncpus[nnodes] = ncpus - node_first[nnodes];
+    if (node_ncpus[nnodes] > 0)
+      nnodes++; // skip nodes with no CPUs of ours
+  }
+  return ncpus;
+}
+
+// Pin one side of the pipeline to an explicit CPU list, returns -1 if it is malformed
+int affinity_set_cpus(int role, const char * list)
+{
+  list_ncpus[role] = affinity_parse_cpus(list, list_cpus[role], CPU_SETSIZE);
+  return list_ncpus[role] > 0 ? 0 : -1;
+}
+
+// CPU for one member of pair i, side 0 or 1
+static int affinity_pick(int i, int side)
+{
+  if (AFFINITY == AFFINITY_COMPACT)
+    return cpus[(2 * i + side) % ncpus];
+  // scatter: pair i goes to node i % nnodes, both members on that node
+  int node = i % nnodes;
+  int k = 2 * (i / nnodes) + side;
+  return cpus[node_first[node] + k % node_ncpus[node]];
+}
+
+// Decide where every worker of the next run goes
+void affinity_plan(int producers, int consumers)
+{
+  int count[2] = { producers, consumers };
+  for (int role = 0; role < 2; role++) {
+    free(plan[role]);
+    plan[role] = NULL;
+    plan_size[role] = 0;
+    if (AFFINITY == AFFINITY_NONE || ncpus == 0)
+      continue;
+    if (AFFINITY == AFFINITY_LIST && list_ncpus[role] == 0)
+      continue; // this side was not given a list, leave it to the scheduler
+    plan[role] = (int *) malloc(sizeof(int) * count[role]);
+    plan_size[role] = count[role];
+    for (int i = 0; i < count[role]; i++)
+      plan[role][i] = AFFINITY == AFFINITY_LIST ? list_cpus[role][i % list_ncpus[role]] : affinity_pick(i, role);
+  }
+}
+
+// Pin the calling worker where the plan says and make its allocations node-local
+// Returns the CPU, -1 if the worker was left to the scheduler
+int affinity_apply(int role, int id)
+{
+  if (id >= plan_size[role])
+    return -1;
+  int cpu = plan[role][id];
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+    return -1;
+#if HAVE_LIBNUMA
+  if (numa_available() >= 0)
+    numa_set_localalloc(); // new pages come from this node even if we were started interleaved
+#endif
+  MatrixPoolSetNode(cpu_node[cpu]);
+  return cpu;
+}
+
+int affinity_nodes()
+{
+  return nnodes;
+}
+
+int affinity_cpus()
+{
+  return ncpus;
+}
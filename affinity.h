@@ -0,0 +1,28 @@
+/*
+ *  affinity header
+ *  Function prototypes, data, and constants for worker placement
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Build with libnuma when it is available, see the Makefile
+#ifndef HAVE_LIBNUMA
+#define HAVE_LIBNUMA 0
+#endif
+
+// Worker roles
+#define AFFINITY_PRODUCER 0
+#define AFFINITY_CONSUMER 1
+
+// Most NUMA nodes told apart, higher nodes share lists with lower ones
+#define AFFINITY_MAX_NODES 8
+
+// affinity methods
+int affinity_init();
+int affinity_parse_cpus(const char * list, int * cpus, int max);
+int affinity_set_cpus(int role, const char * list);
+void affinity_plan(int producers, int consumers);
+int affinity_apply(int role, int id);
+int affinity_nodes();
+int affinity_cpus();
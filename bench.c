@@ -0,0 +1,177 @@
+/*
+ *  bench module
+ *  Built-in benchmark mode for pcMatrix
+ *
+ *  Runs the producer/consumer pipeline for every combination of worker
+ *  threads, buffer implementation, buffer size and matrix mode, with
+ *  warmup runs and repeated trials.  For each combination it reports the
+ *  mean and standard deviation of wall time, CPU time, matrices/sec and
+ *  multiplies/sec as JSON or CSV, ready to be diffed between builds.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include "element.h"
+#include "matrix.h"
+#include "counter.h"
+#include "ring.h"
+#include "steal.h"
+#include "match.h"
+#include "lanes.h"
+#include "adapt.h"
+#include "pcmatrix.h"
+#include "prodcons.h"
+#include "bench.h"
+
+// Measurements of one trial
+typedef struct bench_sample {
+  double wall;
+  double cpu;
+  double matrices_per_sec;
+  double mults_per_sec;
+} BenchSample;
+
+void bench_init(BenchConfig * cfg)
+{
+  memset(cfg, 0, sizeof(BenchConfig));
+  cfg->trials = BENCH_DEFAULT_TRIALS;
+  cfg->warmup = BENCH_DEFAULT_WARMUP;
+  cfg->format = BENCH_JSON;
+}
+
+// parse a plain integer, -1 if it is not one
+int bench_parse_int(const char * arg)
+{
+  char * end;
+  long v = strtol(arg, &end, 10);
+  if (end == arg || *end != '\0' || v < 0)
+    return -1;
+  return (int) v;
+}
+
+// parse a comma separated list with parse(), returns the number of values or -1
+int bench_parse_list(const char * arg, int * values, int max, int (*parse)(const char *))
+{
+  char item[64];
+  int n = 0;
+  while (*arg != '\0') {
+    size_t len = strcspn(arg, ",");
+    if (len == 0 || len >= sizeof(item) || n == max)
+      return -1;
+    memcpy(item, arg, len);
+    item[len] = '\0';
+    if ((values[n++] = parse(item)) < 0)
+      return -1;
+    arg += len;
+    if (*arg == ',')
+      arg++;
+  }
+  return n;
+}
+
+static double clock_seconds(clockid_t clk)
+{
+  struct timespec ts;
+  clock_gettime(clk, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void mean_stddev(BenchSample * samples, int n, size_t offset, double * mean, double * stddev)
+{
+  double sum = 0, sq = 0;
+  for (int i = 0; i < n; i++)
+    sum += *(double *) ((char *) &samples[i] + offset);
+  *mean = sum / n;
+  for (int i = 0; i < n; i++) {
+    double d = *(double *) ((char *) &samples[i] + offset) - *mean;
+    sq += d * d;
+  }
+  *stddev = n > 1 ? sqrt(sq / (n - 1)) : 0;
+}
+
+// Run one combination warmup + trials times, report it, returns 0 if any sums mismatched
+static int bench_one(BenchConfig * cfg, int numw, int output_fd, int first)
+{
+  static const char * impl_names[] = { "condvar", "ring", "match", "steal", "lanes" };
+  BenchSample * samples = calloc(cfg->trials, sizeof(BenchSample));
+  int ok = 1;
+  long multiplied = 0;
+  for (int t = -cfg->warmup; t < cfg->trials; t++) {
+    RunTotals totals;
+    double wall = clock_seconds(CLOCK_MONOTONIC);
+    double cpu = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+    run_pipeline(numw, numw, output_fd, &totals);
+    wall = clock_seconds(CLOCK_MONOTONIC) - wall;
+    cpu = clock_seconds(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+    if (totals.prodsum != totals.conssum || totals.produced != totals.consumed)
+      ok = 0;
+    if (t < 0)
+      continue; // warmup
+    samples[t].wall = wall;
+    samples[t].cpu = cpu;
+    samples[t].matrices_per_sec = totals.consumed / wall;
+    samples[t].mults_per_sec = totals.multiplied / wall;
+    multiplied += totals.multiplied;
+  }
+
+  double wall_mean, wall_sd, cpu_mean, cpu_sd, mps_mean, mps_sd, xps_mean, xps_sd;
+  mean_stddev(samples, cfg->trials, offsetof(BenchSample, wall), &wall_mean, &wall_sd);
+  mean_stddev(samples, cfg->trials, offsetof(BenchSample, cpu), &cpu_mean, &cpu_sd);
+  mean_stddev(samples, cfg->trials, offsetof(BenchSample, matrices_per_sec), &mps_mean, &mps_sd);
+  mean_stddev(samples, cfg->trials, offsetof(BenchSample, mults_per_sec), &xps_mean, &xps_sd);
+  free(samples);
+
+  if (cfg->format == BENCH_CSV)
+    printf("%s,%d,%d,%d,%d,%d,%d,%.6f,%.6f,%.6f,%.6f,%.1f,%.1f,%.1f,%.1f,%.1f,%s\n",
+           impl_names[BUFFER_MODE], numw, BOUNDED_BUFFER_SIZE, MATRIX_MODE, NUMBER_OF_MATRICES, BATCH_SIZE, cfg->trials,
+           wall_mean, wall_sd, cpu_mean, cpu_sd, mps_mean, mps_sd, xps_mean, xps_sd,
+           (double) multiplied / cfg->trials, ok ? "true" : "false");
+  else
+    printf("%s    {\"impl\": \"%s\", \"threads\": %d, \"buffer\": %d, \"mode\": %d, \"matrices\": %d, \"batch\": %d, \"trials\": %d,\n"
+           "     \"wall_sec\": {\"mean\": %.6f, \"stddev\": %.6f}, \"cpu_sec\": {\"mean\": %.6f, \"stddev\": %.6f},\n"
+           "     \"matrices_per_sec\": {\"mean\": %.1f, \"stddev\": %.1f}, \"mults_per_sec\": {\"mean\": %.1f, \"stddev\": %.1f},\n"
+           "     \"multiplied_mean\": %.1f, \"sums_match\": %s}",
+           first ? "" : ",\n", impl_names[BUFFER_MODE], numw, BOUNDED_BUFFER_SIZE, MATRIX_MODE, NUMBER_OF_MATRICES, BATCH_SIZE, cfg->trials,
+           wall_mean, wall_sd, cpu_mean, cpu_sd, mps_mean, mps_sd, xps_mean, xps_sd,
+           (double) multiplied / cfg->trials, ok ? "true" : "false");
+  fflush(stdout);
+  return ok;
+}
+
+// Run the whole sweep, returns 0 if every run's sums matched, 1 otherwise
+int bench_run(BenchConfig * cfg, int output_fd)
+{
+  int ok = 1;
+  int first = 1;
+  if (cfg->format == BENCH_CSV)
+    printf("impl,threads,buffer,mode,matrices,batch,trials,wall_sec_mean,wall_sec_stddev,cpu_sec_mean,cpu_sec_stddev,"
+           "matrices_per_sec_mean,matrices_per_sec_stddev,mults_per_sec_mean,mults_per_sec_stddev,multiplied_mean,sums_match\n");
+  else
+    printf("{\"seed\": %lu, \"pool\": %d, \"results\": [\n", RANDOM_SEED, MATRIX_POOL);
+
+  for (int i = 0; i < cfg->nimpls; i++)
+    for (int m = 0; m < cfg->nmodes; m++)
+      for (int b = 0; b < cfg->nbuffers; b++)
+        for (int t = 0; t < cfg->nthreads; t++) {
+          BUFFER_MODE = cfg->impls[i];
+          MATRIX_MODE = cfg->modes[m];
+          BOUNDED_BUFFER_SIZE = cfg->buffers[b];
+          fprintf(stderr, "bench: impl=%d mode=%d buffer=%d threads=%d\n",
+                  BUFFER_MODE, MATRIX_MODE, BOUNDED_BUFFER_SIZE, cfg->threads[t]);
+          if (!bench_one(cfg, cfg->threads[t], output_fd, first))
+            ok = 0;
+          first = 0;
+        }
+
+  if (cfg->format == BENCH_JSON)
+    printf("\n]}\n");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,44 @@
+/*
+ *  bench header
+ *  Function prototypes, data, and constants for the benchmark module
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// BENCHMARK MODE
+
+// Most values in one sweep list
+#define BENCH_MAX_VALUES 32
+
+// Defaults for a sweep
+#define BENCH_DEFAULT_TRIALS 5
+#define BENCH_DEFAULT_WARMUP 1
+#define BENCH_DEFAULT_SEED 422
+
+// Report formats
+#define BENCH_JSON 0
+#define BENCH_CSV 1
+
+// Benchmark settings, every combination of the sweep lists is run
+// warmup runs per combination are discarded, trials runs are reported
+typedef struct bench_config {
+  int enabled;
+  int threads[BENCH_MAX_VALUES];
+  int nthreads;
+  int buffers[BENCH_MAX_VALUES];
+  int nbuffers;
+  int modes[BENCH_MAX_VALUES];
+  int nmodes;
+  int impls[BENCH_MAX_VALUES]; // BUFFER_MODE values
+  int nimpls;
+  int trials;
+  int warmup;
+  int format;
+} BenchConfig;
+
+// bench methods
+void bench_init(BenchConfig * cfg);
+int bench_parse_list(const char * arg, int * values, int max, int (*parse)(const char *));
+int bench_parse_int(const char * arg);
+int bench_run(BenchConfig * cfg, int output_fd);
@@ -0,0 +1,279 @@
+/*
+ *  chain module
+ *  Multiplies chains of compatible matrices in their cheapest order
+ *
+ *  In chain mode a consumer collects A1 A2 ... An, each matrix's columns
+ *  matching the next one's rows, and multiplies the whole chain.  The
+ *  product is the same in any order, but the work is not: with a 1x4,
+ *  4x1 and 1x4 chain, (A1 A2) A3 takes 8 multiply-adds and A1 (A2 A3)
+ *  takes 32.  The classic dynamic program over every split of every
+ *  sub-chain finds the cheapest order in O(n^3) steps, which costs next
+ *  to nothing next to the multiplies for any chain worth the name.
+ *
+ *  Intermediate products go to a scratch area the consumer keeps from
+ *  chain to chain, only the final product is a matrix of its own.
+ *
+ *  Every CHAIN_COMPARE_EVERY-th chain is also multiplied left to right,
+ *  so the report can give measured wall time next to the multiply-adds
+ *  saved, and a mismatch between the two products would show up there.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+#include <time.h>
+#include <pthread.h>
+#include "element.h"
+#include "matrix.h"
+#include "mulpool.h"
+#include "chain.h"
+
+// Scratch allocations are rounded to this many Products, keeping them MATRIX_ALIGN aligned
+#define CHAIN_SCRATCH_ROUND (MATRIX_ALIGN / sizeof(Product))
+
+static pthread_mutex_t chain_lock = PTHREAD_MUTEX_INITIALIZER;
+static ChainStats chain_totals;
+
+static unsigned long chain_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+Chain * chain_create()
+{
+  Chain * c = (Chain *) calloc(1, sizeof(Chain));
+  assert(c != 0);
+  return c;
+}
+
+// Append mat to the chain if it can be multiplied onto the end
+// Returns 1 if it was added, 0 if its rows do not match the last matrix's columns
+int chain_add(Chain * c, Matrix * mat)
+{
+  if (c->count > 0 && c->items[c->count - 1]->cols != mat->rows)
+    return 0;
+  assert(c->count < CHAIN_MAX);
+  c->items[c->count++] = mat;
+  return 1;
+}
+
+// Fill cost and split for the chain, shortest sub-chains first
+static void chain_order(Chain * c)
+{
+  int n = c->count;
+  int * d = c->dims;
+  for (int i = 0; i < n; i++) {
+    d[i] = c->items[i]->rows;
+    c->cost[i][i] = 0;
+  }
+  d[n] = c->items[n - 1]->cols;
+  for (int len = 2; len <= n; len++)
+    for (int i = 0; i + len <= n; i++) {
+      int j = i + len - 1;
+      c->cost[i][j] = LONG_MAX;
+      for (int s = i; s < j; s++) {
+        long q = c->cost[i][s] + c->cost[s + 1][j] + (long) d[i] * d[s + 1] * d[j + 1];
+        if (q < c->cost[i][j]) {
+          c->cost[i][j] = q;
+          c->split[i][j] = s;
+        }
+      }
+    }
+}
+
+// Make sure the scratch area holds every intermediate of the chain in
+// either order: at most n + 1 of them, none larger than the biggest
+// dimension squared, and n copied leaves if Products are wider; it only
+// ever grows
+static void chain_reserve(Chain * c)
+{
+  size_t largest = 0;
+  for (int i = 0; i <= c->count; i++)
+    if ((size_t) c->dims[i] > largest)
+      largest = c->dims[i];
+  size_t each = (largest * largest + CHAIN_SCRATCH_ROUND - 1) / CHAIN_SCRATCH_ROUND * CHAIN_SCRATCH_ROUND;
+  size_t need = each * (c->count + 1);
+#if PRODUCT_WIDE
+  need += each * c->count;
+#endif
+  if (need > c->scratch_size) {
+    free(c->scratch);
+    c->scratch = (Product *) aligned_alloc(MATRIX_ALIGN, sizeof(Product) * need);
+    assert(c->scratch != 0);
+    c->scratch_size = need;
+  }
+  c->scratch_used = 0;
+}
+
+// Room for an intermediate of elems Products
+static Product * chain_scratch(Chain * c, size_t elems)
+{
+  Product * p = c->scratch + c->scratch_used;
+  c->scratch_used += (elems + CHAIN_SCRATCH_ROUND - 1) / CHAIN_SCRATCH_ROUND * CHAIN_SCRATCH_ROUND;
+  assert(c->scratch_used <= c->scratch_size);
+  return p;
+}
+
+// Point leaves at the chain's elements, widened into scratch if Products
+// are wider than Elements, so every multiply of the chain is on Products
+static void chain_leaves(Chain * c)
+{
+  for (int i = 0; i < c->count; i++) {
+#if PRODUCT_WIDE
+    Matrix * mat = c->items[i];
+    size_t elems = (size_t) mat->rows * mat->cols;
+    Product * p = chain_scratch(c, elems);
+    for (size_t e = 0; e < elems; e++)
+      p[e] = mat->data[e];
+    c->leaves[i] = p;
+#else
+    c->leaves[i] = c->items[i]->data;
+#endif
+  }
+}
+
+// Multiply items i..j in the order split gives into dst and return it,
+// or return items[i]'s leaf when i == j
+static const Product * chain_eval(Chain * c, int i, int j, Product * dst)
+{
+  if (i == j)
+    return c->leaves[i];
+  int * d = c->dims;
+  int s = c->split[i][j];
+  const Product * a = chain_eval(c, i, s, s == i ? NULL : chain_scratch(c, (size_t) d[i] * d[s + 1]));
+  const Product * b = chain_eval(c, s + 1, j, s + 1 == j ? NULL : chain_scratch(c, (size_t) d[s + 1] * d[j + 1]));
+  mulpool_multiply_products(a, b, dst, d[i], d[s + 1], d[j + 1]);
+  return dst;
+}
+
+// Multiply the chain left to right into dst, alternating between two intermediates
+static void chain_eval_left(Chain * c, Product * dst)
+{
+  int n = c->count;
+  int * d = c->dims;
+  size_t largest = 0;
+  for (int k = 2; k < n; k++)
+    if ((size_t) d[k] > largest)
+      largest = d[k];
+  Product * temp[2] = { chain_scratch(c, d[0] * largest), chain_scratch(c, d[0] * largest) };
+  const Product * acc = c->leaves[0];
+  for (int k = 1; k < n; k++) {
+    Product * out = k == n - 1 ? dst : temp[k & 1];
+    mulpool_multiply_products(acc, c->leaves[k], out, d[0], d[k], d[k + 1]);
+    acc = out;
+  }
+}
+
+// Multiply a chain of two or more matrices in its cheapest order
+// Returns the product, a new matrix; the chain's matrices are left alone
+Matrix * chain_multiply(Chain * c)
+{
+  int n = c->count;
+  assert(n >= 2);
+  chain_order(c);
+  chain_reserve(c);
+  chain_leaves(c);
+  int * d = c->dims;
+  long left = 0;
+  for (int k = 1; k < n; k++)
+    left += (long) d[0] * d[k] * d[k + 1];
+  c->stats.chains++;
+  c->stats.matrices += n;
+  c->stats.optimal_madds += c->cost[0][n - 1];
+  c->stats.naive_madds += left;
+
+  Matrix * product = AllocProduct(d[0], d[n]);
+  if (c->stats.chains % CHAIN_COMPARE_EVERY != 0) {
+    chain_eval(c, 0, n - 1, product->product);
+    return product;
+  }
+
+  // sampled: time both orders, alternating which goes first so neither
+  // always finds the operands already in cache
+  Product * check = chain_scratch(c, (size_t) d[0] * d[n]);
+  int left_first = c->stats.sampled++ & 1;
+  unsigned long t0 = chain_now(), t1, t2;
+  if (left_first)
+    chain_eval_left(c, check);
+  t1 = chain_now();
+  chain_eval(c, 0, n - 1, product->product);
+  t2 = chain_now();
+  if (!left_first)
+    chain_eval_left(c, check);
+  c->stats.optimal_ns += t2 - t1;
+  c->stats.naive_ns += left_first ? t1 - t0 : chain_now() - t2;
+  if (memcmp(check, product->product, sizeof(Product) * d[0] * d[n]) != 0)
+    c->stats.mismatches++;
+  return product;
+}
+
+// Free the chain's matrices and start a new chain
+void chain_clear(Chain * c)
+{
+  for (int i = 0; i < c->count; i++)
+    FreeMatrix(c->items[i]);
+  c->count = 0;
+}
+
+static void chain_add_stats(ChainStats * to, ChainStats * from)
+{
+  to->chains += from->chains;
+  to->matrices += from->matrices;
+  to->optimal_madds += from->optimal_madds;
+  to->naive_madds += from->naive_madds;
+  to->sampled += from->sampled;
+  to->optimal_ns += from->optimal_ns;
+  to->naive_ns += from->naive_ns;
+  to->mismatches += from->mismatches;
+}
+
+// Add the chain's statistics to the run's totals and free it, chain_clear() must have emptied it
+void chain_destroy(Chain * c)
+{
+  chain_merge(&c->stats);
+  free(c->scratch);
+  free(c);
+}
+
+void chain_reset()
+{
+  pthread_mutex_lock(&chain_lock);
+  memset(&chain_totals, 0, sizeof(chain_totals));
+  pthread_mutex_unlock(&chain_lock);
+}
+
+// Copy the run's totals so far, e.g. for a worker process to hand to its parent
+void chain_collect(ChainStats * stats)
+{
+  pthread_mutex_lock(&chain_lock);
+  *stats = chain_totals;
+  pthread_mutex_unlock(&chain_lock);
+}
+
+// Add statistics gathered elsewhere to the run's totals
+void chain_merge(ChainStats * stats)
+{
+  pthread_mutex_lock(&chain_lock);
+  chain_add_stats(&chain_totals, stats);
+  pthread_mutex_unlock(&chain_lock);
+}
+
+void chain_report(FILE * stream)
+{
+  ChainStats * t = &chain_totals;
+  fprintf(stream, "Chains: %ld multiplied, %.1f matrices long on average\n",
+          t->chains, t->chains ? (double) t->matrices / t->chains : 0.0);
+  fprintf(stream, "Chain multiply-adds: %ld in the cheapest order, %ld left to right (%.1f%% saved)\n",
+          t->optimal_madds, t->naive_madds,
+          t->naive_madds ? 100.0 * (t->naive_madds - t->optimal_madds) / t->naive_madds : 0.0);
+  fprintf(stream, "Chain wall time on %ld sampled chains: %.3fms in the cheapest order, %.3fms left to right (%.1f%% saved), %ld mismatched products\n",
+          t->sampled, t->optimal_ns / 1e6, t->naive_ns / 1e6,
+          t->naive_ns ? 100.0 * ((double) t->naive_ns - t->optimal_ns) / t->naive_ns : 0.0, t->mismatches);
+}
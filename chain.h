@@ -0,0 +1,63 @@
+/*
+ *  chain header
+ *  Function prototypes, data, and constants for matrix-chain multiplication
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Longest chain a consumer collects, see CHAIN_LENGTH
+#define CHAIN_MAX 64
+
+// Every CHAIN_COMPARE_EVERY-th chain is also evaluated left to right, to
+// time the cheapest order against and check it gives the same product
+#define CHAIN_COMPARE_EVERY 16
+
+// What chains cost, per consumer and per run
+// chains, matrices - chains multiplied and matrices in them
+// optimal_madds    - multiply-adds in the cheapest order
+// naive_madds      - multiply-adds left to right, ((A1 A2) A3) ...
+// sampled          - chains also evaluated left to right
+// optimal_ns, naive_ns - wall time of both orders on the sampled chains
+// mismatches       - sampled chains whose two products differ
+typedef struct chain_stats {
+  long chains;
+  long matrices;
+  long optimal_madds;
+  long naive_madds;
+  long sampled;
+  unsigned long optimal_ns;
+  unsigned long naive_ns;
+  long mismatches;
+} ChainStats;
+
+// A consumer's chain and everything needed to multiply it
+// cost[i][j]  - multiply-adds of the cheapest order for items i..j
+// split[i][j] - where that order splits items i..j in two
+// dims        - items[i] is dims[i] x dims[i + 1]
+// leaves      - items[i]'s elements as Products, copies in scratch if
+//               Products are wider than Elements
+// scratch     - room for the intermediate products, kept from chain to chain
+typedef struct chain {
+  int count;
+  Matrix * items[CHAIN_MAX];
+  int dims[CHAIN_MAX + 1];
+  long cost[CHAIN_MAX][CHAIN_MAX];
+  int split[CHAIN_MAX][CHAIN_MAX];
+  const Product * leaves[CHAIN_MAX];
+  Product * scratch;
+  size_t scratch_size;
+  size_t scratch_used;
+  ChainStats stats;
+} Chain;
+
+// chain methods
+Chain * chain_create();
+int chain_add(Chain * c, Matrix * mat);
+Matrix * chain_multiply(Chain * c);
+void chain_clear(Chain * c);
+void chain_destroy(Chain * c);
+void chain_reset();
+void chain_collect(ChainStats * stats);
+void chain_merge(ChainStats * stats);
+void chain_report(FILE * stream);
@@ -7,26 +7,64 @@
 
 // Include libraries required for this module only
 #include <stdio.h>
-#include <pthread.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stdatomic.h>
 #include "counter.h"
 
 // SYNCHRONIZED COUNTER METHOD IMPLEMENTATION
-// Based on Three Easy Pieces
+// Based on Three Easy Pieces, with the lock replaced by atomic instructions.
+// Relaxed ordering is enough: the counters only count, the data they
+// describe is published by the buffer's own mutex or ring sequence numbers.
 
 void init_cnt(counter_t *c)  {
-  c->value = 0;
-  pthread_mutex_init(&c->lock, NULL);
+  atomic_init(&c->value, 0);
 }
 
 void increment_cnt(counter_t *c)  {
-  pthread_mutex_lock(&c->lock);
-  c->value++;
-  pthread_mutex_unlock(&c->lock);
+  atomic_fetch_add_explicit(&c->value, 1, memory_order_relaxed);
+}
+
+void add_cnt(counter_t *c, int n)  {
+  atomic_fetch_add_explicit(&c->value, n, memory_order_relaxed);
+}
+
+// add n to the counter and return its value before the addition
+int fetch_add_cnt(counter_t *c, int n)  {
+  return atomic_fetch_add_explicit(&c->value, n, memory_order_relaxed);
 }
 
 int get_cnt(counter_t *c)  {
-  pthread_mutex_lock(&c->lock);
-  int rc = c->value;
-  pthread_mutex_unlock(&c->lock);
-  return rc;
+  return atomic_load_explicit(&c->value, memory_order_relaxed);
+}
+
+// SHARDED COUNTER METHOD IMPLEMENTATION
+
+void init_shcnt(sharded_counter_t *c, int nshards)  {
+  c->nshards = nshards;
+  c->shards = (shard_t *) aligned_alloc(CACHE_LINE_SIZE, sizeof(shard_t) * nshards);
+  assert(c->shards != 0);
+  for (int i = 0; i < nshards; i++)
+    atomic_init(&c->shards[i].value, 0);
+}
+
+void free_shcnt(sharded_counter_t *c)  {
+  free(c->shards);
+  c->shards = NULL;
+  c->nshards = 0;
+}
+
+// add delta to a shard, must only be called by the thread owning the shard
+void add_shcnt(sharded_counter_t *c, int shard, long delta)  {
+  shard_t *s = &c->shards[shard];
+  long v = atomic_load_explicit(&s->value, memory_order_relaxed);
+  atomic_store_explicit(&s->value, v + delta, memory_order_relaxed);
+}
+
+// sum of all shards
+long get_shcnt(sharded_counter_t *c)  {
+  long total = 0;
+  for (int i = 0; i < c->nshards; i++)
+    total += atomic_load_explicit(&c->shards[i].value, memory_order_relaxed);
+  return total;
 }
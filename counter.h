@@ -6,12 +6,16 @@
  *  TCSS 422 - Operating Systems
  */
 
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
 // SYNCHRONIZED COUNTER
 
 // counter structures
+// value is updated with atomic instructions, no lock is needed
 typedef struct __counter_t {
-  int value;
-  pthread_mutex_t  lock;
+  _Atomic int value;
 } counter_t;
 
 typedef struct __counters_t {
@@ -19,7 +23,28 @@ typedef struct __counters_t {
   counter_t * cons;
 } counters_t;
 
+// SHARDED COUNTER
+// One padded shard per thread, each written only by its owner.  Cheap to
+// update on the hot path, summed only when the total is needed.
+
+typedef struct __shard_t {
+  _Atomic long value;
+} __attribute__((aligned(CACHE_LINE_SIZE))) shard_t;
+
+typedef struct __sharded_counter_t {
+  int nshards;
+  shard_t * shards;
+} sharded_counter_t;
+
 // counter methods
 void init_cnt(counter_t *c);
 void increment_cnt(counter_t *c);
+void add_cnt(counter_t *c, int n);
+int fetch_add_cnt(counter_t *c, int n);
 int get_cnt(counter_t *c);
+
+// sharded counter methods
+void init_shcnt(sharded_counter_t *c, int nshards);
+void free_shcnt(sharded_counter_t *c);
+void add_shcnt(sharded_counter_t *c, int shard, long delta);
+long get_shcnt(sharded_counter_t *c);
@@ -0,0 +1,70 @@
+/*
+ *  element header
+ *  The element type of every matrix, chosen at build time
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Element types, e.g. make ELEMENT=INT8
+// Generated elements are 1 to 10, which every type holds exactly, so a
+// smaller type shrinks every matrix in the buffer, the pool and the
+// shared-memory slots by as much.  Products cannot shrink with them - a
+// 4x4 product of mode 0 elements reaches 400 - so they are stored as
+// Products, which are int for the narrow integer types and double for
+// float; integer products wrap as int32 products always have.
+#define ELEMENT_INT8 1
+#define ELEMENT_INT16 2
+#define ELEMENT_INT32 3
+#define ELEMENT_INT64 4
+#define ELEMENT_FLOAT 5
+
+#ifndef MATRIX_ELEMENT
+#define MATRIX_ELEMENT ELEMENT_INT32
+#endif
+
+// Element        - what a matrix holds
+// ElementAcc     - what products are summed in before being stored: unsigned
+//                  for integers so sums wrap instead of overflowing, and at
+//                  least 32 bits, double for float
+// ELEMENT_FORMAT - printf format of one element in the text output
+// Product        - what products are stored in, chain intermediates included
+// PRODUCT_WIDE   - 1 if Product is wider than Element
+#if MATRIX_ELEMENT == ELEMENT_INT8
+typedef signed char Element;
+typedef unsigned int ElementAcc;
+typedef int Product;
+#define PRODUCT_WIDE 1
+#define ELEMENT_NAME "int8"
+#define ELEMENT_FORMAT "%3d"
+#elif MATRIX_ELEMENT == ELEMENT_INT16
+typedef short Element;
+typedef unsigned int ElementAcc;
+typedef int Product;
+#define PRODUCT_WIDE 1
+#define ELEMENT_NAME "int16"
+#define ELEMENT_FORMAT "%3d"
+#elif MATRIX_ELEMENT == ELEMENT_INT32
+typedef int Element;
+typedef unsigned int ElementAcc;
+typedef int Product;
+#define PRODUCT_WIDE 0
+#define ELEMENT_NAME "int32"
+#define ELEMENT_FORMAT "%3d"
+#elif MATRIX_ELEMENT == ELEMENT_INT64
+typedef long Element;
+typedef unsigned long ElementAcc;
+typedef long Product;
+#define PRODUCT_WIDE 0
+#define ELEMENT_NAME "int64"
+#define ELEMENT_FORMAT "%3ld"
+#elif MATRIX_ELEMENT == ELEMENT_FLOAT
+typedef float Element;
+typedef double ElementAcc;
+typedef double Product;
+#define PRODUCT_WIDE 1
+#define ELEMENT_NAME "float"
+#define ELEMENT_FORMAT "%3g"
+#else
+#error "MATRIX_ELEMENT must be one of ELEMENT_INT8, ELEMENT_INT16, ELEMENT_INT32, ELEMENT_INT64 or ELEMENT_FLOAT"
+#endif
@@ -0,0 +1,184 @@
+/*
+ *  input module
+ *  Replays recorded matrices from memory-mapped binary files
+ *
+ *  Input files hold the same records the binary result output writes:
+ *  a MatrixRecordHeader followed by rows * cols Elements; records of
+ *  a different element size, such as products of a narrow type, are
+ *  refused.  Files
+ *  are mapped read-only and never copied; each matrix handed to the
+ *  pipeline points straight into the mapping, so a data set can be far
+ *  larger than RAM and the kernel pages it in and out as the producers
+ *  walk through it.
+ *
+ *  Producers share one cursor over the files and claim records in
+ *  order, a batch at a time.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "element.h"
+#include "matrix.h"
+#include "output.h"
+#include "input.h"
+
+static InputFile files[INPUT_MAX_FILES];
+static int nfiles;
+
+// shared cursor, the next record to hand out
+static pthread_mutex_t cursor_lock = PTHREAD_MUTEX_INITIALIZER;
+static int cursor_file;
+static size_t cursor_offset;
+
+// Size of the record at offset, 0 if it runs past the end or is malformed
+static size_t input_record_size(InputFile * f, size_t offset)
+{
+  MatrixRecordHeader hdr;
+  if (f->size - offset < sizeof(hdr))
+    return 0;
+  memcpy(&hdr, f->base + offset, sizeof(hdr));
+  if (hdr.rows <= 0 || hdr.cols <= 0 || hdr.size != (int) sizeof(Element))
+    return 0;
+  size_t bytes = sizeof(hdr) + sizeof(Element) * (size_t) hdr.rows * hdr.cols;
+  return bytes <= f->size - offset ? bytes : 0;
+}
+
+// Map a file of matrix records and add it to the input
+// Only the record headers are read here, to count and check the records
+// Returns the number of records in the file, -1 on error
+long input_open(const char * path)
+{
+  if (nfiles == INPUT_MAX_FILES) {
+    fprintf(stderr, "%s: more than %d input files\n", path, INPUT_MAX_FILES);
+    return -1;
+  }
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror(path);
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    fprintf(stderr, "%s: empty or unreadable input file\n", path);
+    close(fd);
+    return -1;
+  }
+  InputFile * f = &files[nfiles];
+  f->path = path;
+  f->size = st.st_size;
+  f->base = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); // the mapping keeps the file open
+  if (f->base == MAP_FAILED) {
+    perror(path);
+    return -1;
+  }
+  f->records = 0;
+  f->largest = 0;
+  for (size_t offset = 0, bytes; offset < f->size; offset += bytes) {
+    if ((bytes = input_record_size(f, offset)) == 0) {
+      MatrixRecordHeader hdr = { 0 };
+      if (f->size - offset >= sizeof(hdr))
+        memcpy(&hdr, f->base + offset, sizeof(hdr));
+      if (hdr.size > 0 && hdr.size != (int) sizeof(Element))
+        fprintf(stderr, "%s: record at offset %zu holds %d byte elements, this build's are %zu\n", path, offset, hdr.size, sizeof(Element));
+      else
+        fprintf(stderr, "%s: bad matrix record at offset %zu\n", path, offset);
+      munmap(f->base, f->size);
+      return -1;
+    }
+    long elements = (bytes - sizeof(MatrixRecordHeader)) / sizeof(Element);
+    if (elements > f->largest)
+      f->largest = elements;
+    f->records++;
+  }
+  madvise(f->base, f->size, MADV_SEQUENTIAL); // records are claimed front to back
+  nfiles++;
+  return f->records;
+}
+
+// Number of records in all input files
+long input_count()
+{
+  long count = 0;
+  for (int i = 0; i < nfiles; i++)
+    count += files[i].records;
+  return count;
+}
+
+// Elements of the largest record in all input files
+long input_largest()
+{
+  long largest = 0;
+  for (int i = 0; i < nfiles; i++)
+    if (files[i].largest > largest)
+      largest = files[i].largest;
+  return largest;
+}
+
+// Start handing out records from the first file again
+void input_rewind()
+{
+  pthread_mutex_lock(&cursor_lock);
+  cursor_file = 0;
+  cursor_offset = 0;
+  pthread_mutex_unlock(&cursor_lock);
+}
+
+// Start handing out records from record number record, counted across the
+// files; walks the record headers, so it costs a pass over the skipped ones
+void input_seek(long record)
+{
+  pthread_mutex_lock(&cursor_lock);
+  cursor_file = 0;
+  cursor_offset = 0;
+  while (record > 0 && cursor_file < nfiles) {
+    InputFile * f = &files[cursor_file];
+    if (cursor_offset == f->size) {
+      cursor_file++;
+      cursor_offset = 0;
+      continue;
+    }
+    cursor_offset += input_record_size(f, cursor_offset);
+    record--;
+  }
+  pthread_mutex_unlock(&cursor_lock);
+}
+
+// Claim the next n records as matrices whose data points into the mapping
+// Returns the number claimed, fewer than n once the input runs out
+int input_next_many(Matrix ** values, int n)
+{
+  int k = 0;
+  pthread_mutex_lock(&cursor_lock);
+  while (k < n && cursor_file < nfiles) {
+    InputFile * f = &files[cursor_file];
+    if (cursor_offset == f->size) {
+      cursor_file++;
+      cursor_offset = 0;
+      continue;
+    }
+    MatrixRecordHeader hdr;
+    memcpy(&hdr, f->base + cursor_offset, sizeof(hdr));
+    values[k++] = MatrixMapped(hdr.rows, hdr.cols, (Element *) (f->base + cursor_offset + sizeof(hdr)));
+    cursor_offset += sizeof(hdr) + sizeof(Element) * (size_t) hdr.rows * hdr.cols;
+  }
+  pthread_mutex_unlock(&cursor_lock);
+  return k;
+}
+
+// Unmap every input file, no matrix from them may still be in use
+void input_close()
+{
+  for (int i = 0; i < nfiles; i++)
+    munmap(files[i].base, files[i].size);
+  nfiles = 0;
+}
@@ -0,0 +1,32 @@
+/*
+ *  input header
+ *  Function prototypes, data, and constants for memory-mapped matrix input
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Most input files that can be replayed in one run
+#define INPUT_MAX_FILES 64
+
+// A mapped file of binary matrix records (see MatrixRecordHeader)
+// base    - start of the read-only mapping
+// size    - length of the file
+// records - number of matrix records in the file
+// largest - elements of the largest record
+typedef struct input_file {
+  const char * path;
+  char * base;
+  size_t size;
+  long records;
+  long largest;
+} InputFile;
+
+// input methods
+long input_open(const char * path);
+long input_count();
+long input_largest();
+void input_rewind();
+void input_seek(long record);
+int input_next_many(Matrix ** values, int n);
+void input_close();
@@ -0,0 +1,115 @@
+/*
+ *  instrument module
+ *  Hot path instrumentation for the producer/consumer pipeline
+ *
+ *  Each thread records into its own thread-local InstrStats, with no
+ *  sharing on the hot path, and adds them to its role's totals when it
+ *  exits.  Built only when INSTRUMENT is 1, otherwise every routine is
+ *  an empty stub and the macros in instrument.h expand to nothing.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "instrument.h"
+#include "pcmatrix.h"
+
+#if INSTRUMENT
+
+__thread InstrStats instr_local;
+
+static pthread_mutex_t instr_lock = PTHREAD_MUTEX_INITIALIZER;
+static InstrStats instr_totals[2]; // per role
+static int instr_threads[2];
+
+unsigned long instr_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+void instr_occupancy(int occupied)
+{
+  int b = (int) ((long) occupied * INSTR_OCC_BUCKETS / (BOUNDED_BUFFER_SIZE + 1));
+  if (b < 0)
+    b = 0;
+  if (b >= INSTR_OCC_BUCKETS)
+    b = INSTR_OCC_BUCKETS - 1;
+  instr_local.occupancy[b]++;
+}
+
+void instr_reset()
+{
+  pthread_mutex_lock(&instr_lock);
+  memset(instr_totals, 0, sizeof(instr_totals));
+  memset(instr_threads, 0, sizeof(instr_threads));
+  pthread_mutex_unlock(&instr_lock);
+}
+
+// add the calling thread's statistics to its role's totals and clear them
+void instr_thread_flush(int role)
+{
+  InstrStats * t = &instr_totals[role];
+  pthread_mutex_lock(&instr_lock);
+  t->wait_empty_ns += instr_local.wait_empty_ns;
+  t->wait_full_ns += instr_local.wait_full_ns;
+  t->mutex_hold_ns += instr_local.mutex_hold_ns;
+  t->futile_wakeups += instr_local.futile_wakeups;
+  for (int i = 0; i < 3; i++)
+    t->waits_ended[i] += instr_local.waits_ended[i];
+  t->generate_ns += instr_local.generate_ns;
+  t->sum_ns += instr_local.sum_ns;
+  t->multiply_ns += instr_local.multiply_ns;
+  for (int i = 0; i < INSTR_OCC_BUCKETS; i++)
+    t->occupancy[i] += instr_local.occupancy[i];
+  instr_threads[role]++;
+  pthread_mutex_unlock(&instr_lock);
+  memset(&instr_local, 0, sizeof(instr_local));
+}
+
+void instr_report(FILE * stream)
+{
+  static const char * roles[] = { "producers", "consumers" };
+  long occupancy[INSTR_OCC_BUCKETS] = { 0 };
+  long samples = 0;
+  for (int r = 0; r < 2; r++) {
+    InstrStats * t = &instr_totals[r];
+    fprintf(stream, "Instrumentation %s (%d threads): wait_empty=%.3fms wait_full=%.3fms mutex_held=%.3fms futile_wakeups=%ld"
+            " generate=%.3fms sum=%.3fms multiply=%.3fms\n",
+            roles[r], instr_threads[r], t->wait_empty_ns / 1e6, t->wait_full_ns / 1e6, t->mutex_hold_ns / 1e6,
+            t->futile_wakeups, t->generate_ns / 1e6, t->sum_ns / 1e6, t->multiply_ns / 1e6);
+    if (t->waits_ended[0] + t->waits_ended[1] + t->waits_ended[2] > 0)
+      fprintf(stream, "Adaptive waits %s: spun=%ld yielded=%ld parked=%ld\n",
+              roles[r], t->waits_ended[0], t->waits_ended[1], t->waits_ended[2]);
+    for (int i = 0; i < INSTR_OCC_BUCKETS; i++) {
+      occupancy[i] += t->occupancy[i];
+      samples += t->occupancy[i];
+    }
+  }
+  fprintf(stream, "Buffer occupancy histogram (%ld samples):", samples);
+  for (int i = 0; i < INSTR_OCC_BUCKETS; i++)
+    fprintf(stream, " %d-%d%%=%.1f%%", i * 100 / INSTR_OCC_BUCKETS, (i + 1) * 100 / INSTR_OCC_BUCKETS,
+            samples ? 100.0 * occupancy[i] / samples : 0.0);
+  fprintf(stream, "\n");
+}
+
+#else
+
+void instr_reset()
+{
+}
+
+void instr_thread_flush(int role)
+{
+}
+
+void instr_report(FILE * stream)
+{
+}
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ *  instrument header
+ *  Macros, data, and constants for hot path instrumentation
+ *
+ *  Everything here compiles to nothing unless INSTRUMENT is set to 1,
+ *  e.g. make INSTRUMENT=1
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+#ifndef INSTRUMENT
+#define INSTRUMENT 0
+#endif
+
+// Number of buffer occupancy histogram buckets, each covers 1/INSTR_OCC_BUCKETS of the buffer
+#define INSTR_OCC_BUCKETS 10
+
+// Thread roles, statistics are aggregated per role
+#define INSTR_PRODUCER 0
+#define INSTR_CONSUMER 1
+
+// Statistics one thread records
+// wait_empty_ns  - time producers waited for space (empty)
+// wait_full_ns   - time consumers waited for data (full)
+// mutex_hold_ns  - time holding the buffer mutex, not counting condition waits
+// futile_wakeups - wakeups that found no work and went back to sleep
+// waits_ended    - adaptive waits that ended spinning, yielding and parked (park.h)
+// generate_ns, sum_ns, multiply_ns - time in GenMatrixRandom, SumMatrix, MatrixMultiply
+// occupancy      - histogram of buffer occupancy seen at each put/get
+typedef struct instr_stats {
+  unsigned long wait_empty_ns;
+  unsigned long wait_full_ns;
+  unsigned long mutex_hold_ns;
+  long futile_wakeups;
+  long waits_ended[3];
+  unsigned long generate_ns;
+  unsigned long sum_ns;
+  unsigned long multiply_ns;
+  long occupancy[INSTR_OCC_BUCKETS];
+} InstrStats;
+
+// One critical section on the buffer mutex
+// locked - when the mutex was taken
+// waited - time spent in condition waits since then
+// waits  - waits in the current wait loop
+typedef struct instr_section {
+  unsigned long locked;
+  unsigned long waited;
+  long waits;
+} InstrSection;
+
+#if INSTRUMENT
+
+extern __thread InstrStats instr_local;
+
+unsigned long instr_now();
+void instr_occupancy(int occupied);
+
+// time statement stmt into field
+#define INSTR_TIME(field, stmt) do { unsigned long t0_ = instr_now(); stmt; instr_local.field += instr_now() - t0_; } while (0)
+
+// start a critical section, right after locking the mutex
+#define INSTR_SECTION(s) InstrSection s = { instr_now(), 0, 0 }
+
+// condition wait inside section s, the wait is charged to field
+#define INSTR_WAIT(s, cv, m, field) do { unsigned long t0_ = instr_now(); pthread_cond_wait(cv, m); \
+    unsigned long d_ = instr_now() - t0_; s.waited += d_; instr_local.field += d_; s.waits++; } while (0)
+
+// adaptive wait stmt inside section s, charged to field like INSTR_WAIT
+#define INSTR_PARK(s, stmt, field) do { unsigned long t0_ = instr_now(); stmt; \
+    unsigned long d_ = instr_now() - t0_; s.waited += d_; instr_local.field += d_; s.waits++; } while (0)
+
+// end of a wait loop, every wakeup but the last one found no work
+#define INSTR_WAITED(s) do { if (s.waits > 1) instr_local.futile_wakeups += s.waits - 1; s.waits = 0; } while (0)
+
+// end a critical section, right before unlocking the mutex
+#define INSTR_END_SECTION(s) (instr_local.mutex_hold_ns += instr_now() - s.locked - s.waited)
+
+// add to a statistic directly
+#define INSTR_ADD(field, n) (instr_local.field += (n))
+
+// record buffer occupancy
+#define INSTR_OCCUPANCY(n) instr_occupancy(n)
+
+#else
+
+#define INSTR_TIME(field, stmt) do { stmt; } while (0)
+#define INSTR_SECTION(s)
+#define INSTR_WAIT(s, cv, m, field) pthread_cond_wait(cv, m)
+#define INSTR_PARK(s, stmt, field) do { stmt; } while (0)
+#define INSTR_WAITED(s) ((void) 0)
+#define INSTR_END_SECTION(s) ((void) 0)
+#define INSTR_ADD(field, n) ((void) 0)
+#define INSTR_OCCUPANCY(n) ((void) 0)
+
+#endif
+
+// instrumentation methods, no-ops unless INSTRUMENT is set
+void instr_reset();
+void instr_thread_flush(int role);
+void instr_report(FILE * stream);
@@ -0,0 +1,188 @@
+/*
+ *  lanes module
+ *  Bounded buffer that routes matrices to lanes by multiply cost
+ *
+ *  When matrix sizes vary, a consumer busy with one large multiply holds
+ *  up every small matrix queued behind it.  Here each matrix is classed
+ *  when it is put, by the multiply-adds a product with it would cost,
+ *  and queued in the small or the large lane.  Each lane is served by its
+ *  own group of consumers, so small matrices keep flowing while large
+ *  ones are being multiplied.  A consumer whose lane is empty takes from
+ *  the other lane rather than sit idle, and the lanes share one pool of
+ *  slots so neither can starve the producers.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Include only libraries for this module
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+#include "element.h"
+#include "matrix.h"
+#include "lanes.h"
+#include "instrument.h"
+
+Lanes * lanes_create(int capacity, long threshold)
+{
+  Lanes * l = (Lanes *) malloc(sizeof(Lanes));
+  assert(l != 0);
+  for (int i = 0; i < LANE_COUNT; i++) {
+    l->lane[i].items = (Matrix **) malloc(sizeof(Matrix *) * capacity); // a lane may hold every slot
+    assert(l->lane[i].items != 0);
+    l->lane[i].head = 0;
+    l->lane[i].count = 0;
+    l->lane[i].waiting = 0;
+    pthread_cond_init(&l->lane[i].ready, NULL);
+    l->routed[i] = 0;
+  }
+  l->capacity = capacity;
+  l->count = 0;
+  l->threshold = threshold;
+  l->waiting_producers = 0;
+  l->spilled = 0;
+  pthread_mutex_init(&l->lock, NULL);
+  pthread_cond_init(&l->notfull, NULL);
+  return l;
+}
+
+void lanes_destroy(Lanes * l)
+{
+  for (int i = 0; i < LANE_COUNT; i++) {
+    pthread_cond_destroy(&l->lane[i].ready);
+    free(l->lane[i].items);
+  }
+  pthread_mutex_destroy(&l->lock);
+  pthread_cond_destroy(&l->notfull);
+  free(l);
+}
+
+// Estimated multiply-adds of a product with m, taking its partner to be
+// about as large as m's larger dimension
+long lanes_cost(Matrix * m)
+{
+  long big = m->rows > m->cols ? m->rows : m->cols;
+  return (long) m->rows * m->cols * big;
+}
+
+// Lane consumer id serves when share percent of the consumers serve the
+// large lane; a single consumer serves the small lane and spills over
+int lanes_of_consumer(int id, int consumers, int share)
+{
+  int large = (consumers * share + 50) / 100;
+  if (large < 1 && consumers > 1)
+    large = 1;
+  if (large >= consumers)
+    large = consumers - 1;
+  return id >= consumers - large ? LANE_LARGE : LANE_SMALL;
+}
+
+// Wake consumers for n matrices in a lane: its own group if any of them
+// are asleep, else one of the other group, which takes them as spillover
+// (a consumer only sleeps when both lanes are empty)
+static void lanes_wake(Lanes * l, int lane, int n)
+{
+  Lane * own = &l->lane[lane];
+  Lane * other = &l->lane[1 - lane];
+  if (n <= 0)
+    return;
+  if (own->waiting > 0) {
+    if (n > 1)
+      pthread_cond_broadcast(&own->ready);
+    else
+      pthread_cond_signal(&own->ready);
+  }
+  else if (other->waiting > 0)
+    pthread_cond_signal(&other->ready);
+}
+
+// put n matrices into their lanes, blocking while every slot is taken
+void lanes_put_many(Lanes * l, Matrix ** values, int n)
+{
+  int added[LANE_COUNT] = { 0 };
+  pthread_mutex_lock(&l->lock);
+  INSTR_SECTION(section);
+  for (int i = 0; i < n; i++) {
+    while (l->count >= l->capacity) {
+      for (int j = 0; j < LANE_COUNT; j++) { // consumers must hear about this batch before we sleep on it
+        lanes_wake(l, j, added[j]);
+        added[j] = 0;
+      }
+      l->waiting_producers++;
+      INSTR_WAIT(section, &l->notfull, &l->lock, wait_empty_ns);
+      l->waiting_producers--;
+    }
+    INSTR_WAITED(section);
+    INSTR_OCCUPANCY(l->count);
+    int lane = lanes_cost(values[i]) >= l->threshold ? LANE_LARGE : LANE_SMALL;
+    Lane * q = &l->lane[lane];
+    q->items[(q->head + q->count) % l->capacity] = values[i];
+    q->count++;
+    l->count++;
+    l->routed[lane]++;
+    added[lane]++;
+  }
+  for (int j = 0; j < LANE_COUNT; j++)
+    if (added[j] > 0)
+      lanes_wake(l, j, added[j]);
+  INSTR_END_SECTION(section);
+  pthread_mutex_unlock(&l->lock);
+}
+
+// get n matrices for a consumer of lane home, from its own lane while it
+// has any and from the other lane when it is empty, blocking while both are
+// The caller must have reserved the n matrices so they are sure to come
+void lanes_get_many(Lanes * l, int home, Matrix ** values, int n)
+{
+  int done = 0;
+  int freed = 0; // slots producers have not been told about
+  pthread_mutex_lock(&l->lock);
+  INSTR_SECTION(section);
+  while (done < n) {
+    Lane * q = &l->lane[home];
+    if (q->count == 0 && l->lane[1 - home].count > 0) {
+      q = &l->lane[1 - home]; // our lane is idle, help out the other one
+      l->spilled++;
+    }
+    if (q->count == 0) {
+      if (freed > 0) // producers must hear about the space before we sleep on it
+        pthread_cond_broadcast(&l->notfull);
+      freed = 0;
+      q->waiting++;
+      INSTR_WAIT(section, &q->ready, &l->lock, wait_full_ns);
+      q->waiting--;
+      continue;
+    }
+    INSTR_WAITED(section);
+    INSTR_OCCUPANCY(l->count);
+    values[done++] = q->items[q->head];
+    q->head = (q->head + 1) % l->capacity;
+    q->count--;
+    l->count--;
+    freed++;
+  }
+  if (freed > 1)
+    pthread_cond_broadcast(&l->notfull); // signal that buffer has space, once per batch
+  else if (freed == 1)
+    pthread_cond_signal(&l->notfull);
+  for (int j = 0; j < LANE_COUNT; j++)
+    lanes_wake(l, j, l->lane[j].count > 0); // pass on what a broadcast woke too few consumers for
+  INSTR_END_SECTION(section);
+  pthread_mutex_unlock(&l->lock);
+}
+
+// number of matrices in the lanes right now
+int lanes_count(Lanes * l)
+{
+  return __atomic_load_n(&l->count, __ATOMIC_RELAXED);
+}
+
+// number of producers and consumers asleep on the lanes right now
+void lanes_blocked(Lanes * l, int * producers, int * consumers)
+{
+  *producers = __atomic_load_n(&l->waiting_producers, __ATOMIC_RELAXED);
+  *consumers = __atomic_load_n(&l->lane[LANE_SMALL].waiting, __ATOMIC_RELAXED)
+             + __atomic_load_n(&l->lane[LANE_LARGE].waiting, __ATOMIC_RELAXED);
+}
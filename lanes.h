@@ -0,0 +1,50 @@
+/*
+ *  lanes header
+ *  Function prototypes, data, and constants for the size-routed buffer module
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// SIZE-ROUTED LANES
+
+// Lanes matrices are routed to by estimated multiply cost
+#define LANE_SMALL 0
+#define LANE_LARGE 1
+#define LANE_COUNT 2
+
+// One lane, a circular queue with its own consumer group
+// waiting - consumers of this lane asleep on ready
+typedef struct lane {
+  Matrix ** items;
+  int head; // next matrix to take
+  int count;
+  int waiting;
+  pthread_cond_t ready;
+} Lane;
+
+// Bounded buffer split into lanes that share capacity slots
+// threshold - estimated multiply-adds from which a matrix goes to the large lane
+// routed    - matrices put into each lane
+// spilled   - matrices taken by a consumer of the other lane
+typedef struct lanes {
+  Lane lane[LANE_COUNT];
+  int capacity;
+  int count;
+  long threshold;
+  int waiting_producers;
+  pthread_mutex_t lock;
+  pthread_cond_t notfull;
+  long routed[LANE_COUNT];
+  long spilled;
+} Lanes;
+
+// lanes methods
+Lanes * lanes_create(int capacity, long threshold);
+void lanes_destroy(Lanes * l);
+long lanes_cost(Matrix * m);
+void lanes_put_many(Lanes * l, Matrix ** values, int n);
+void lanes_get_many(Lanes * l, int home, Matrix ** values, int n);
+int lanes_of_consumer(int id, int consumers, int share);
+int lanes_count(Lanes * l);
+void lanes_blocked(Lanes * l, int * producers, int * consumers);
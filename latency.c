@@ -0,0 +1,179 @@
+/*
+ *  latency module
+ *  Per-matrix queueing and end-to-end latency
+ *
+ *  With --latency every matrix carries the times it was generated and
+ *  put into the buffer.  The consumer that takes it out records how long
+ *  it sat there, and once its product has been handed to the output, how
+ *  long it took from generation.  Latencies go into log-linear histograms
+ *  in the style of HDR histograms: constant memory, a fixed relative
+ *  error, and any percentile can be read off at the end.
+ *
+ *  Each thread records into histograms of its own and adds them to the
+ *  run's totals when it exits, so the hot path shares nothing.  A batch
+ *  of matrices is stamped with one clock read.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "element.h"
+#include "matrix.h"
+#include "latency.h"
+#include "pcmatrix.h"
+
+static __thread LatencyStats latency_local;
+
+static pthread_mutex_t latency_lock = PTHREAD_MUTEX_INITIALIZER;
+static LatencyStats latency_totals;
+
+unsigned long latency_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts); // one clock for every process
+  return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+// Bucket of a latency: values below 2^LATENCY_SUB_BITS have a bucket each,
+// above that every power of two has 2^LATENCY_SUB_BITS buckets
+static int latency_bucket(unsigned long ns)
+{
+  if (ns < (1UL << LATENCY_SUB_BITS))
+    return (int) ns;
+  if (ns >= (1UL << LATENCY_MAX_BITS))
+    return LATENCY_BUCKETS - 1;
+  int group = 63 - __builtin_clzl(ns) - LATENCY_SUB_BITS + 1;
+  return (group << LATENCY_SUB_BITS) + (int) (ns >> (group - 1)) - (1 << LATENCY_SUB_BITS);
+}
+
+// Highest latency that falls in bucket b
+static unsigned long latency_bucket_value(int b)
+{
+  int group = b >> LATENCY_SUB_BITS;
+  unsigned long sub = b & ((1 << LATENCY_SUB_BITS) - 1);
+  if (group == 0)
+    return sub;
+  return ((sub + (1UL << LATENCY_SUB_BITS)) << (group - 1)) + (1UL << (group - 1)) - 1;
+}
+
+static void latency_record(LatencyHist * h, unsigned long ns)
+{
+  h->buckets[latency_bucket(ns)]++;
+  h->count++;
+  if (ns > h->max)
+    h->max = ns;
+}
+
+static void latency_add(LatencyHist * to, LatencyHist * from)
+{
+  for (int b = 0; b < LATENCY_BUCKETS; b++)
+    to->buckets[b] += from->buckets[b];
+  to->count += from->count;
+  if (from->max > to->max)
+    to->max = from->max;
+}
+
+// Smallest latency at or above fraction p of the recorded ones
+static unsigned long latency_percentile(LatencyHist * h, double p)
+{
+  long rank = (long) (p * h->count + 0.999999);
+  if (rank < 1)
+    rank = 1;
+  long seen = 0;
+  for (int b = 0; b < LATENCY_BUCKETS; b++)
+    if ((seen += h->buckets[b]) >= rank) {
+      unsigned long v = latency_bucket_value(b);
+      return v < h->max ? v : h->max;
+    }
+  return h->max;
+}
+
+void latency_reset()
+{
+  pthread_mutex_lock(&latency_lock);
+  memset(&latency_totals, 0, sizeof(latency_totals));
+  pthread_mutex_unlock(&latency_lock);
+}
+
+// Stamp a matrix as generated now
+void latency_born(Matrix * mat)
+{
+  if (LATENCY)
+    mat->born = latency_now();
+}
+
+// Stamp n matrices as put into the buffer now
+void latency_enqueued(Matrix ** values, int n)
+{
+  if (!LATENCY || n <= 0)
+    return;
+  unsigned long now = latency_now();
+  for (int i = 0; i < n; i++)
+    values[i]->enqueued = now;
+}
+
+// Record how long n matrices just taken from the buffer sat in it
+void latency_dequeued(Matrix ** values, int n)
+{
+  if (!LATENCY || n <= 0)
+    return;
+  unsigned long now = latency_now();
+  for (int i = 0; i < n; i++)
+    latency_record(&latency_local.queue, now - values[i]->enqueued);
+}
+
+// Record how long n matrices took from generation to their product's output
+void latency_done(Matrix ** values, int n)
+{
+  if (!LATENCY || n <= 0)
+    return;
+  unsigned long now = latency_now();
+  for (int i = 0; i < n; i++)
+    latency_record(&latency_local.total, now - values[i]->born);
+}
+
+// Add the calling thread's histograms to the run's totals and clear them
+void latency_thread_flush()
+{
+  if (!LATENCY)
+    return;
+  pthread_mutex_lock(&latency_lock);
+  latency_add(&latency_totals.queue, &latency_local.queue);
+  latency_add(&latency_totals.total, &latency_local.total);
+  pthread_mutex_unlock(&latency_lock);
+  memset(&latency_local, 0, sizeof(latency_local));
+}
+
+// Copy the run's totals so far, e.g. for a worker process to hand to its parent
+void latency_collect(LatencyStats * stats)
+{
+  pthread_mutex_lock(&latency_lock);
+  *stats = latency_totals;
+  pthread_mutex_unlock(&latency_lock);
+}
+
+// Add histograms recorded elsewhere to the run's totals
+void latency_merge(LatencyStats * stats)
+{
+  pthread_mutex_lock(&latency_lock);
+  latency_add(&latency_totals.queue, &stats->queue);
+  latency_add(&latency_totals.total, &stats->total);
+  pthread_mutex_unlock(&latency_lock);
+}
+
+static void latency_line(FILE * stream, const char * name, LatencyHist * h)
+{
+  fprintf(stream, "Latency %s (%ld matrices): p50=%.1fus p99=%.1fus p99.9=%.1fus max=%.1fus\n", name, h->count,
+          latency_percentile(h, 0.50) / 1e3, latency_percentile(h, 0.99) / 1e3,
+          latency_percentile(h, 0.999) / 1e3, h->max / 1e3);
+}
+
+void latency_report(FILE * stream)
+{
+  latency_line(stream, "in buffer", &latency_totals.queue);
+  latency_line(stream, "end-to-end", &latency_totals.total);
+}
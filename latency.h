@@ -0,0 +1,44 @@
+/*
+ *  latency header
+ *  Function prototypes, data, and constants for per-matrix latency tracking
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Histogram resolution: each power of two is split into 2^LATENCY_SUB_BITS
+// linear buckets, so a recorded value is off by at most 1/32, about 3%
+#define LATENCY_SUB_BITS 5
+
+// Largest latency told apart, 2^40 ns is about 18 minutes; longer ones
+// land in the last bucket, max is still exact
+#define LATENCY_MAX_BITS 40
+
+#define LATENCY_BUCKETS ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS)
+
+// Log-linear histogram of latencies in nanoseconds, HDR histogram style
+typedef struct latency_hist {
+  long count;
+  unsigned long max;
+  long buckets[LATENCY_BUCKETS];
+} LatencyHist;
+
+// Latencies of one thread, or of a whole run
+// queue - from being put into the buffer to being taken out of it
+// total - from generation to the product being handed to the output
+typedef struct latency_stats {
+  LatencyHist queue;
+  LatencyHist total;
+} LatencyStats;
+
+// latency methods, all no-ops unless LATENCY is set
+unsigned long latency_now();
+void latency_reset();
+void latency_born(Matrix * mat);
+void latency_enqueued(Matrix ** values, int n);
+void latency_dequeued(Matrix ** values, int n);
+void latency_done(Matrix ** values, int n);
+void latency_thread_flush();
+void latency_collect(LatencyStats * stats);
+void latency_merge(LatencyStats * stats);
+void latency_report(FILE * stream);
@@ -0,0 +1,194 @@
+/*
+ *  matbench module
+ *  Microbenchmark for the integer matrix multiply kernels
+ *
+ *  Multiplies random N x N matrices with every kernel this CPU supports,
+ *  checks each result against the original naive loop, and reports
+ *  GOPS (2 * N^3 integer operations per multiply) and speedup.
+ *  The unrolled small shape kernels are checked for every shape they
+ *  cover and timed on the square ones, and the batched kernels are
+ *  checked and timed on batches of BENCH_BATCH tiny pairs.
+ *
+ *  usage: matbench [size ...]
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "element.h"
+#include "matmul.h"
+
+// Minimum time spent timing each kernel at each size
+#define BENCH_MIN_SECONDS 0.5
+
+// Pairs per batch when timing the batched kernels, and their largest dimension
+#define BENCH_BATCH 16
+#define BENCH_BATCH_DIM 4
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Seconds per multiply, repeating until BENCH_MIN_SECONDS have passed
+// The clock is read every batch multiplies, so tiny ones are not swamped by it
+static double time_kernel(MatMulKernel kernel, const Element * a, const Element * b, Product * c, int n, int batch)
+{
+  long reps = 0;
+  double start = now();
+  double elapsed;
+  do {
+    for (int i = 0; i < batch; i++)
+      kernel(a, b, c, n, n, n);
+    reps += batch;
+    elapsed = now() - start;
+  } while (elapsed < BENCH_MIN_SECONDS);
+  return elapsed / reps;
+}
+
+// Check every unrolled kernel against the naive loop and time the square ones
+static void bench_fixed()
+{
+  Element a[GEMM_UNROLL_MAX * GEMM_UNROLL_MAX], b[GEMM_UNROLL_MAX * GEMM_UNROLL_MAX];
+  Product ref[GEMM_UNROLL_MAX * GEMM_UNROLL_MAX], c[GEMM_UNROLL_MAX * GEMM_UNROLL_MAX];
+  for (int i = 0; i < GEMM_UNROLL_MAX * GEMM_UNROLL_MAX; i++)
+  {
+    a[i] = rand() - RAND_MAX / 2;
+    b[i] = rand() - RAND_MAX / 2;
+  }
+  int shapes = 0, bad = 0;
+  for (int n = 1; n <= GEMM_UNROLL_MAX; n++)
+    for (int k = 1; k <= GEMM_UNROLL_MAX; k++)
+      for (int m = 1; m <= GEMM_UNROLL_MAX; m++)
+      {
+        MatMulNaive(a, b, ref, n, k, m);
+        MatMulFixed(n, k, m)(a, b, c, n, k, m);
+        shapes++;
+        bad += memcmp(c, ref, sizeof(Product) * n * m) != 0;
+      }
+  printf("unrolled kernels: %d shapes, %s\n", shapes, bad ? "MISMATCH" : "ok");
+  for (int n = 1; n <= GEMM_UNROLL_MAX; n++)
+  {
+    double base = time_kernel(MatMulNaive, a, b, c, n, 1000);
+    double sec = time_kernel(MatMulFixed(n, n, n), a, b, c, n, 1000);
+    printf("%6d %-8s %12.9f %10.3f %7.2fx\n", n, "unrolled", sec, 2.0 * n * n * n / sec / 1e9, base / sec);
+  }
+}
+
+// Seconds per pair for one batched kernel on a batch of n x n by n x n pairs
+static double time_batch(MatMulBatchKernel kernel, const Element * a, const Element * b, Product * c, int n)
+{
+  long reps = 0;
+  double start = now();
+  double elapsed;
+  do {
+    for (int i = 0; i < 1000; i++)
+      kernel(a, b, c, n, n, n, BENCH_BATCH);
+    reps += 1000;
+    elapsed = now() - start;
+  } while (elapsed < BENCH_MIN_SECONDS);
+  return elapsed / reps / BENCH_BATCH;
+}
+
+// Check every batched kernel against the naive loop on each pair, and time
+// them against multiplying the pairs one at a time with the naive loop
+static void bench_batch()
+{
+  enum { ELEMS = BENCH_BATCH_DIM * BENCH_BATCH_DIM };
+  static Element a[ELEMS * BENCH_BATCH], b[ELEMS * BENCH_BATCH];
+  static Product c[ELEMS * BENCH_BATCH];
+  Element pa[ELEMS], pb[ELEMS];
+  Product ref[ELEMS];
+  for (int i = 0; i < ELEMS * BENCH_BATCH; i++)
+  {
+    a[i] = rand() - RAND_MAX / 2;
+    b[i] = rand() - RAND_MAX / 2;
+  }
+  for (const MatMulImpl * impl = MatMulImpls; impl->name != NULL; impl++)
+  {
+    if (!impl->supported())
+      continue;
+    int bad = 0;
+    for (int n = 1; n <= BENCH_BATCH_DIM; n++)
+      for (int k = 1; k <= BENCH_BATCH_DIM; k++)
+        for (int m = 1; m <= BENCH_BATCH_DIM; m++)
+        {
+          impl->batch(a, b, c, n, k, m, BENCH_BATCH);
+          for (int p = 0; p < BENCH_BATCH; p++)
+          {
+            for (int e = 0; e < n * k; e++)
+              pa[e] = a[e * BENCH_BATCH + p];
+            for (int e = 0; e < k * m; e++)
+              pb[e] = b[e * BENCH_BATCH + p];
+            MatMulNaive(pa, pb, ref, n, k, m);
+            for (int e = 0; e < n * m; e++)
+              bad += c[e * BENCH_BATCH + p] != ref[e];
+          }
+        }
+    printf("batched %-8s %d pairs per batch, %s\n", impl->name, BENCH_BATCH, bad ? "MISMATCH" : "ok");
+    for (int n = 2; n <= BENCH_BATCH_DIM; n++)
+    {
+      double base = time_kernel(MatMulNaive, a, b, c, n, 1000);
+      double sec = time_batch(impl->batch, a, b, c, n);
+      printf("%6d %-8s %12.9f %10.3f %7.2fx\n", n, "batched", sec, 2.0 * n * n * n / sec / 1e9, base / sec);
+    }
+  }
+}
+
+int main(int argc, char * argv[])
+{
+  int default_sizes[] = { 16, 64, 128, 256, 512 };
+  int nsizes = argc > 1 ? argc - 1 : (int) (sizeof(default_sizes) / sizeof(default_sizes[0]));
+
+  srand(422);
+  printf("element type: %s\n", ELEMENT_NAME);
+  printf("selected kernel: %s\n", MatMulSelectName());
+  printf("%6s %-8s %12s %10s %8s %s\n", "size", "kernel", "sec/mult", "GOPS", "speedup", "check");
+  for (int s = 0; s < nsizes; s++)
+  {
+    int n = argc > 1 ? atoi(argv[s + 1]) : default_sizes[s];
+    if (n <= 0)
+      continue;
+    size_t elems = (size_t) n * n;
+    Element * a = malloc(sizeof(Element) * elems);
+    Element * b = malloc(sizeof(Element) * elems);
+    Product * ref = malloc(sizeof(Product) * elems);
+    Product * c = malloc(sizeof(Product) * elems);
+    for (size_t i = 0; i < elems; i++)
+    {
+      a[i] = 1 + rand() % 10;
+      b[i] = 1 + rand() % 10;
+    }
+    MatMulNaive(a, b, ref, n, n, n);
+
+    double base = 0;
+    for (const MatMulImpl * impl = MatMulImpls; impl->name != NULL; impl++)
+    {
+      if (!impl->supported())
+        continue;
+      memset(c, 0xff, sizeof(Product) * elems);
+      double sec = time_kernel(impl->kernel, a, b, c, n, 1);
+      if (base == 0)
+        base = sec; // naive loop is the first entry
+      int ok = memcmp(c, ref, sizeof(Product) * elems) == 0;
+      printf("%6d %-8s %12.6f %10.3f %7.2fx %s\n", n, impl->name, sec,
+             2.0 * n * n * n / sec / 1e9, base / sec, ok ? "ok" : "MISMATCH");
+    }
+    free(a);
+    free(b);
+    free(ref);
+    free(c);
+  }
+  if (argc == 1)
+  {
+    bench_fixed();
+    bench_batch();
+  }
+  return 0;
+}
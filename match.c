@@ -0,0 +1,108 @@
+/*
+ *  match module
+ *  Bounded buffer indexed by matrix shape
+ *
+ *  Matrices are kept in arrival order and, at the same time, in a bucket
+ *  chosen by their row count.  A consumer holding an R x C matrix can
+ *  take the oldest matrix with C rows straight from its bucket instead of
+ *  pulling and discarding incompatible matrices one at a time.  Every
+ *  operation is O(1) as long as bucket collisions are rare.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Include only libraries for this module
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "element.h"
+#include "matrix.h"
+#include "match.h"
+
+static MatchNode * bucket_of(MatchIndex * idx, int rows)
+{
+  return &idx->buckets[rows % MATCH_BUCKETS];
+}
+
+MatchIndex * match_create(int capacity)
+{
+  MatchIndex * idx = (MatchIndex *) malloc(sizeof(MatchIndex));
+  assert(idx != 0);
+  idx->nodes = (MatchNode *) malloc(sizeof(MatchNode) * capacity);
+  assert(idx->nodes != 0);
+  idx->capacity = capacity;
+  idx->count = 0;
+  idx->free = NULL;
+  for (int i = capacity - 1; i >= 0; i--) {
+    idx->nodes[i].next = idx->free;
+    idx->free = &idx->nodes[i];
+  }
+  idx->fifo.prev = idx->fifo.next = &idx->fifo;
+  for (int i = 0; i < MATCH_BUCKETS; i++)
+    idx->buckets[i].bprev = idx->buckets[i].bnext = &idx->buckets[i];
+  return idx;
+}
+
+void match_destroy(MatchIndex * idx)
+{
+  free(idx->nodes);
+  free(idx);
+}
+
+// Insert a matrix, returns 0 if the index is full
+int match_insert(MatchIndex * idx, Matrix * value)
+{
+  if (idx->free == NULL)
+    return 0;
+  MatchNode * node = idx->free;
+  idx->free = node->next;
+  node->value = value;
+
+  // append to arrival order
+  node->prev = idx->fifo.prev;
+  node->next = &idx->fifo;
+  idx->fifo.prev->next = node;
+  idx->fifo.prev = node;
+
+  // append to rows bucket
+  MatchNode * bucket = bucket_of(idx, value->rows);
+  node->bprev = bucket->bprev;
+  node->bnext = bucket;
+  bucket->bprev->bnext = node;
+  bucket->bprev = node;
+
+  idx->count++;
+  return 1;
+}
+
+// Unlink a node from both lists and recycle it
+static Matrix * match_remove(MatchIndex * idx, MatchNode * node)
+{
+  node->prev->next = node->next;
+  node->next->prev = node->prev;
+  node->bprev->bnext = node->bnext;
+  node->bnext->bprev = node->bprev;
+  node->next = idx->free;
+  idx->free = node;
+  idx->count--;
+  return node->value;
+}
+
+// Take the oldest matrix, NULL if the index is empty
+Matrix * match_take_oldest(MatchIndex * idx)
+{
+  if (idx->fifo.next == &idx->fifo)
+    return NULL;
+  return match_remove(idx, idx->fifo.next);
+}
+
+// Take the oldest matrix with the given number of rows, NULL if there is none
+Matrix * match_take_rows(MatchIndex * idx, int rows)
+{
+  MatchNode * bucket = bucket_of(idx, rows);
+  for (MatchNode * node = bucket->bnext; node != bucket; node = node->bnext)
+    if (node->value->rows == rows)
+      return match_remove(idx, node);
+  return NULL;
+}
@@ -0,0 +1,40 @@
+/*
+ *  match header
+ *  Function prototypes, data, and constants for the shape-indexed buffer module
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// SHAPE-INDEXED BUFFER
+
+// Number of row-count buckets, matrices with rows % MATCH_BUCKETS equal share a bucket
+#define MATCH_BUCKETS 64
+
+// A buffered matrix, linked into the arrival order list and into its rows bucket
+typedef struct match_node {
+  Matrix * value;
+  struct match_node * prev; // arrival order list
+  struct match_node * next;
+  struct match_node * bprev; // rows bucket list
+  struct match_node * bnext;
+} MatchNode;
+
+// Bounded buffer indexed by matrix row count
+// fifo and buckets are circular lists with sentinel heads; nodes are
+// preallocated and recycled through the free list, so no operation allocates
+typedef struct match_index {
+  int capacity;
+  int count;
+  MatchNode * nodes;
+  MatchNode * free; // unused nodes, linked through next
+  MatchNode fifo;
+  MatchNode buckets[MATCH_BUCKETS];
+} MatchIndex;
+
+// match index methods, the caller provides locking
+MatchIndex * match_create(int capacity);
+void match_destroy(MatchIndex * idx);
+int match_insert(MatchIndex * idx, Matrix * value);
+Matrix * match_take_oldest(MatchIndex * idx);
+Matrix * match_take_rows(MatchIndex * idx, int rows);
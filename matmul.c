@@ -0,0 +1,483 @@
+/*
+ *  matmul module
+ *  Matrix multiply kernels for the matrix module
+ *
+ *  The blocked kernels walk the right operand one cache-sized panel at a
+ *  time and update whole rows of the result (i-k-j order), so the inner
+ *  loop streams contiguous memory instead of striding down columns.
+ *  SSE4.1 and AVX2 versions of the row update are compiled with function
+ *  target attributes and chosen at runtime from the CPU's feature flags;
+ *  they work on 32-bit lanes, so builds with another element type (see
+ *  element.h) get loops that sum in a wider type and store Products
+ *  instead, compiled once for the baseline and once for AVX2.
+ *
+ *  Tiny products, such as the 1x1 to 4x4 operands of matrix mode 0, are
+ *  dominated by loop overhead instead, so every shape up to
+ *  GEMM_UNROLL_MAX in each dimension gets its own fully unrolled kernel,
+ *  looked up by shape.  When many pairs of one tiny shape are at hand,
+ *  the batched kernels multiply them all at once from structure-of-arrays
+ *  operands, vectorizing across the pairs instead of within a matrix.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "element.h"
+#include "matmul.h"
+#if GEMM_SIMD
+#include <immintrin.h>
+#endif
+
+// Reference kernel, the original i-j-k triple loop
+void MatMulNaive(const Element * a, const Element * b, Product * c, int n, int k, int m)
+{
+  for (int i = 0; i < n; i++)
+  {
+    for (int j = 0; j < m; j++)
+    {
+      ElementAcc sum = 0;
+      for (int kk = 0; kk < k; kk++)
+        sum += (ElementAcc) a[i * k + kk] * (ElementAcc) b[kk * m + j];
+      c[i * m + j] = (Product) sum;
+    }
+  }
+}
+
+#if MATRIX_ELEMENT == ELEMENT_INT32
+
+// c[0..len) += s * b[0..len), wrapping
+static inline void AxpyScalar(int * c, const int * b, int s, int len)
+{
+  for (int j = 0; j < len; j++)
+    c[j] = (int) ((unsigned int) c[j] + (unsigned int) s * (unsigned int) b[j]);
+}
+
+// Blocked i-k-j loop nest shared by every kernel, AXPY updates one row segment
+#define GEMM_BLOCKED(AXPY)                                                  \
+  memset(c, 0, sizeof(int) * (size_t) n * m);                               \
+  for (int j0 = 0; j0 < m; j0 += GEMM_BLOCK_J)                              \
+  {                                                                         \
+    int jlen = m - j0 < GEMM_BLOCK_J ? m - j0 : GEMM_BLOCK_J;               \
+    for (int k0 = 0; k0 < k; k0 += GEMM_BLOCK_K)                            \
+    {                                                                       \
+      int k1 = k0 + GEMM_BLOCK_K < k ? k0 + GEMM_BLOCK_K : k;               \
+      for (int i = 0; i < n; i++)                                           \
+      {                                                                     \
+        int * crow = c + (size_t) i * m + j0;                               \
+        const int * arow = a + (size_t) i * k;                              \
+        for (int kk = k0; kk < k1; kk++)                                    \
+          AXPY(crow, b + (size_t) kk * m + j0, arow[kk], jlen);             \
+      }                                                                     \
+    }                                                                       \
+  }
+
+void MatMulBlocked(const Element * a, const Element * b, Product * c, int n, int k, int m)
+{
+  GEMM_BLOCKED(AxpyScalar)
+}
+
+// c[0..len) += a[0..len) * b[0..len), wrapping
+static inline void MacScalar(int * c, const int * a, const int * b, int len)
+{
+  for (int p = 0; p < len; p++)
+    c[p] = (int) ((unsigned int) c[p] + (unsigned int) a[p] * (unsigned int) b[p]);
+}
+
+// Batched i-j-k loop nest, MAC updates one result element of every pair
+#define GEMM_BATCH(MAC)                                                     \
+  memset(c, 0, sizeof(int) * (size_t) n * m * count);                       \
+  for (int i = 0; i < n; i++)                                               \
+    for (int j = 0; j < m; j++)                                             \
+      for (int kk = 0; kk < k; kk++)                                        \
+        MAC(c + (size_t) (i * m + j) * count, a + (size_t) (i * k + kk) * count, \
+            b + (size_t) (kk * m + j) * count, count);
+
+void MatMulBatchScalar(const Element * a, const Element * b, Product * c, int n, int k, int m, int count)
+{
+  GEMM_BATCH(MacScalar)
+}
+
+#else
+
+// Other element types sum each row segment of the result, or one result
+// element of a run of pairs, in ElementAcc and store it once as a Product,
+// so narrow integers never overflow and float is summed in double; T is
+// the operand type, Element or, for chain intermediates, Product
+#define GEMM_WIDE_BLOCKED(T)                                                \
+  ElementAcc acc[GEMM_BLOCK_J];                                             \
+  for (int j0 = 0; j0 < m; j0 += GEMM_BLOCK_J)                              \
+  {                                                                         \
+    int jlen = m - j0 < GEMM_BLOCK_J ? m - j0 : GEMM_BLOCK_J;               \
+    for (int i = 0; i < n; i++)                                             \
+    {                                                                       \
+      const T * arow = a + (size_t) i * k;                                  \
+      for (int j = 0; j < jlen; j++)                                        \
+        acc[j] = 0;                                                         \
+      for (int kk = 0; kk < k; kk++)                                        \
+      {                                                                     \
+        ElementAcc s = (ElementAcc) arow[kk];                               \
+        const T * brow = b + (size_t) kk * m + j0;                          \
+        for (int j = 0; j < jlen; j++)                                      \
+          acc[j] += s * (ElementAcc) brow[j];                               \
+      }                                                                     \
+      Product * crow = c + (size_t) i * m + j0;                             \
+      for (int j = 0; j < jlen; j++)                                        \
+        crow[j] = (Product) acc[j];                                         \
+    }                                                                       \
+  }
+
+#define GEMM_WIDE_BATCH                                                     \
+  ElementAcc acc[GEMM_BATCH_RUN];                                           \
+  for (int p0 = 0; p0 < count; p0 += GEMM_BATCH_RUN)                        \
+  {                                                                         \
+    int len = count - p0 < GEMM_BATCH_RUN ? count - p0 : GEMM_BATCH_RUN;    \
+    for (int i = 0; i < n; i++)                                             \
+      for (int j = 0; j < m; j++)                                           \
+      {                                                                     \
+        for (int p = 0; p < len; p++)                                       \
+          acc[p] = 0;                                                       \
+        for (int kk = 0; kk < k; kk++)                                      \
+        {                                                                   \
+          const Element * ap = a + (size_t) (i * k + kk) * count + p0;      \
+          const Element * bp = b + (size_t) (kk * m + j) * count + p0;      \
+          for (int p = 0; p < len; p++)                                     \
+            acc[p] += (ElementAcc) ap[p] * (ElementAcc) bp[p];              \
+        }                                                                   \
+        Product * cp = c + (size_t) (i * m + j) * count + p0;               \
+        for (int p = 0; p < len; p++)                                       \
+          cp[p] = (Product) acc[p];                                         \
+      }                                                                     \
+  }
+
+// -O2 only vectorizes loops that need no remainder handling, these need it;
+// the AVX2 versions are the same loops compiled for wider registers
+#pragma GCC push_options
+#pragma GCC optimize ("vect-cost-model=dynamic")
+void MatMulBlocked(const Element * a, const Element * b, Product * c, int n, int k, int m)
+{
+  GEMM_WIDE_BLOCKED(Element)
+}
+
+void MatMulBatchScalar(const Element * a, const Element * b, Product * c, int n, int k, int m, int count)
+{
+  GEMM_WIDE_BATCH
+}
+
+#if PRODUCT_WIDE
+void MatMulProductsBlocked(const Product * a, const Product * b, Product * c, int n, int k, int m)
+{
+  GEMM_WIDE_BLOCKED(Product)
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+void MatMulAVX2(const Element * a, const Element * b, Product * c, int n, int k, int m)
+{
+  GEMM_WIDE_BLOCKED(Element)
+}
+
+__attribute__((target("avx2")))
+void MatMulBatchAVX2(const Element * a, const Element * b, Product * c, int n, int k, int m, int count)
+{
+  GEMM_WIDE_BATCH
+}
+
+#if PRODUCT_WIDE
+__attribute__((target("avx2")))
+void MatMulProductsAVX2(const Product * a, const Product * b, Product * c, int n, int k, int m)
+{
+  GEMM_WIDE_BLOCKED(Product)
+}
+#endif
+#endif
+#pragma GCC pop_options
+
+#endif
+
+static int AlwaysSupported()
+{
+  return 1;
+}
+
+#if GEMM_SIMD
+
+__attribute__((target("sse4.1")))
+static inline void AxpySSE41(int * c, const int * b, int s, int len)
+{
+  __m128i vs = _mm_set1_epi32(s);
+  int j = 0;
+  for (; j + 4 <= len; j += 4)
+  {
+    __m128i vb = _mm_loadu_si128((const __m128i *) (b + j));
+    __m128i vc = _mm_loadu_si128((const __m128i *) (c + j));
+    vc = _mm_add_epi32(vc, _mm_mullo_epi32(vs, vb));
+    _mm_storeu_si128((__m128i *) (c + j), vc);
+  }
+  AxpyScalar(c + j, b + j, s, len - j);
+}
+
+__attribute__((target("avx2")))
+static inline void AxpyAVX2(int * c, const int * b, int s, int len)
+{
+  __m256i vs = _mm256_set1_epi32(s);
+  int j = 0;
+  for (; j + 16 <= len; j += 16)
+  {
+    __m256i vb0 = _mm256_loadu_si256((const __m256i *) (b + j));
+    __m256i vb1 = _mm256_loadu_si256((const __m256i *) (b + j + 8));
+    __m256i vc0 = _mm256_loadu_si256((const __m256i *) (c + j));
+    __m256i vc1 = _mm256_loadu_si256((const __m256i *) (c + j + 8));
+    vc0 = _mm256_add_epi32(vc0, _mm256_mullo_epi32(vs, vb0));
+    vc1 = _mm256_add_epi32(vc1, _mm256_mullo_epi32(vs, vb1));
+    _mm256_storeu_si256((__m256i *) (c + j), vc0);
+    _mm256_storeu_si256((__m256i *) (c + j + 8), vc1);
+  }
+  for (; j + 8 <= len; j += 8)
+  {
+    __m256i vb = _mm256_loadu_si256((const __m256i *) (b + j));
+    __m256i vc = _mm256_loadu_si256((const __m256i *) (c + j));
+    vc = _mm256_add_epi32(vc, _mm256_mullo_epi32(vs, vb));
+    _mm256_storeu_si256((__m256i *) (c + j), vc);
+  }
+  AxpyScalar(c + j, b + j, s, len - j);
+}
+
+__attribute__((target("sse4.1")))
+static inline void MacSSE41(int * c, const int * a, const int * b, int len)
+{
+  int p = 0;
+  for (; p + 4 <= len; p += 4)
+  {
+    __m128i va = _mm_loadu_si128((const __m128i *) (a + p));
+    __m128i vb = _mm_loadu_si128((const __m128i *) (b + p));
+    __m128i vc = _mm_loadu_si128((const __m128i *) (c + p));
+    _mm_storeu_si128((__m128i *) (c + p), _mm_add_epi32(vc, _mm_mullo_epi32(va, vb)));
+  }
+  MacScalar(c + p, a + p, b + p, len - p);
+}
+
+__attribute__((target("avx2")))
+static inline void MacAVX2(int * c, const int * a, const int * b, int len)
+{
+  int p = 0;
+  for (; p + 8 <= len; p += 8)
+  {
+    __m256i va = _mm256_loadu_si256((const __m256i *) (a + p));
+    __m256i vb = _mm256_loadu_si256((const __m256i *) (b + p));
+    __m256i vc = _mm256_loadu_si256((const __m256i *) (c + p));
+    _mm256_storeu_si256((__m256i *) (c + p), _mm256_add_epi32(vc, _mm256_mullo_epi32(va, vb)));
+  }
+  MacScalar(c + p, a + p, b + p, len - p);
+}
+
+__attribute__((target("sse4.1")))
+void MatMulSSE41(const Element * a, const Element * b, Product * c, int n, int k, int m)
+{
+  GEMM_BLOCKED(AxpySSE41)
+}
+
+__attribute__((target("avx2")))
+void MatMulAVX2(const Element * a, const Element * b, Product * c, int n, int k, int m)
+{
+  GEMM_BLOCKED(AxpyAVX2)
+}
+
+__attribute__((target("sse4.1")))
+void MatMulBatchSSE41(const Element * a, const Element * b, Product * c, int n, int k, int m, int count)
+{
+  GEMM_BATCH(MacSSE41)
+}
+
+__attribute__((target("avx2")))
+void MatMulBatchAVX2(const Element * a, const Element * b, Product * c, int n, int k, int m, int count)
+{
+  GEMM_BATCH(MacAVX2)
+}
+
+static int SupportsSSE41()
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse4.1");
+}
+
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+static int SupportsAVX2()
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+#endif
+
+const MatMulImpl MatMulImpls[] = {
+  { "naive", MatMulNaive, MatMulBatchScalar, AlwaysSupported },
+  { "blocked", MatMulBlocked, MatMulBatchScalar, AlwaysSupported },
+#if GEMM_SIMD
+  { "sse4.1", MatMulSSE41, MatMulBatchSSE41, SupportsSSE41 },
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+  { "avx2", MatMulAVX2, MatMulBatchAVX2, SupportsAVX2 },
+#endif
+  { NULL, NULL, NULL, NULL }
+};
+
+// FIXED SHAPE KERNELS
+
+#if GEMM_UNROLL_MAX < 1 || GEMM_UNROLL_MAX > 8
+#error "GEMM_UNROLL_MAX must be between 1 and 8"
+#endif
+
+// Naive loop with the shape as compile time constants, the compiler
+// unrolls it completely and keeps the operands in registers
+#define GEMM_FIXED_BODY(N, K, M)                                            \
+  _Pragma("GCC unroll 8")                                                   \
+  for (int i = 0; i < N; i++)                                               \
+  {                                                                         \
+    _Pragma("GCC unroll 8")                                                 \
+    for (int j = 0; j < M; j++)                                             \
+    {                                                                       \
+      ElementAcc sum = 0;                                                   \
+      _Pragma("GCC unroll 8")                                               \
+      for (int kk = 0; kk < K; kk++)                                        \
+        sum += (ElementAcc) a[i * K + kk] * (ElementAcc) b[kk * M + j];     \
+      c[i * M + j] = (Product) sum;                                         \
+    }                                                                       \
+  }
+
+// Size lists, an entry only exists if it is within GEMM_UNROLL_MAX
+#define GEMM_IF(S, ...) GEMM_IF_##S(__VA_ARGS__)
+#define GEMM_IF_1(...) __VA_ARGS__
+#if GEMM_UNROLL_MAX >= 2
+#define GEMM_IF_2(...) __VA_ARGS__
+#else
+#define GEMM_IF_2(...)
+#endif
+#if GEMM_UNROLL_MAX >= 3
+#define GEMM_IF_3(...) __VA_ARGS__
+#else
+#define GEMM_IF_3(...)
+#endif
+#if GEMM_UNROLL_MAX >= 4
+#define GEMM_IF_4(...) __VA_ARGS__
+#else
+#define GEMM_IF_4(...)
+#endif
+#if GEMM_UNROLL_MAX >= 5
+#define GEMM_IF_5(...) __VA_ARGS__
+#else
+#define GEMM_IF_5(...)
+#endif
+#if GEMM_UNROLL_MAX >= 6
+#define GEMM_IF_6(...) __VA_ARGS__
+#else
+#define GEMM_IF_6(...)
+#endif
+#if GEMM_UNROLL_MAX >= 7
+#define GEMM_IF_7(...) __VA_ARGS__
+#else
+#define GEMM_IF_7(...)
+#endif
+#if GEMM_UNROLL_MAX >= 8
+#define GEMM_IF_8(...) __VA_ARGS__
+#else
+#define GEMM_IF_8(...)
+#endif
+
+// Apply F to every (n, k, m) shape, one list per dimension so they can nest
+#define GEMM_EACH_M(F, N, K) \
+  GEMM_IF(1, F(N, K, 1)) GEMM_IF(2, F(N, K, 2)) GEMM_IF(3, F(N, K, 3)) GEMM_IF(4, F(N, K, 4)) \
+  GEMM_IF(5, F(N, K, 5)) GEMM_IF(6, F(N, K, 6)) GEMM_IF(7, F(N, K, 7)) GEMM_IF(8, F(N, K, 8))
+#define GEMM_EACH_K(F, N) \
+  GEMM_IF(1, GEMM_EACH_M(F, N, 1)) GEMM_IF(2, GEMM_EACH_M(F, N, 2)) GEMM_IF(3, GEMM_EACH_M(F, N, 3)) \
+  GEMM_IF(4, GEMM_EACH_M(F, N, 4)) GEMM_IF(5, GEMM_EACH_M(F, N, 5)) GEMM_IF(6, GEMM_EACH_M(F, N, 6)) \
+  GEMM_IF(7, GEMM_EACH_M(F, N, 7)) GEMM_IF(8, GEMM_EACH_M(F, N, 8))
+#define GEMM_EACH_SHAPE(F) \
+  GEMM_IF(1, GEMM_EACH_K(F, 1)) GEMM_IF(2, GEMM_EACH_K(F, 2)) GEMM_IF(3, GEMM_EACH_K(F, 3)) \
+  GEMM_IF(4, GEMM_EACH_K(F, 4)) GEMM_IF(5, GEMM_EACH_K(F, 5)) GEMM_IF(6, GEMM_EACH_K(F, 6)) \
+  GEMM_IF(7, GEMM_EACH_K(F, 7)) GEMM_IF(8, GEMM_EACH_K(F, 8))
+
+#define GEMM_FIXED_KERNEL(N, K, M)                                          \
+  static void MatMulFixed_##N##_##K##_##M(const Element * a, const Element * b, Product * c, int n, int k, int m) \
+  {                                                                         \
+    GEMM_FIXED_BODY(N, K, M)                                                \
+  }
+GEMM_EACH_SHAPE(GEMM_FIXED_KERNEL)
+
+#define GEMM_FIXED_ENTRY(N, K, M) [N - 1][K - 1][M - 1] = MatMulFixed_##N##_##K##_##M,
+static const MatMulKernel MatMulFixedTable[GEMM_UNROLL_MAX][GEMM_UNROLL_MAX][GEMM_UNROLL_MAX] = {
+  GEMM_EACH_SHAPE(GEMM_FIXED_ENTRY)
+};
+
+MatMulKernel MatMulFixed(int n, int k, int m)
+{
+  if (n < 1 || k < 1 || m < 1 || n > GEMM_UNROLL_MAX || k > GEMM_UNROLL_MAX || m > GEMM_UNROLL_MAX)
+    return NULL;
+  return MatMulFixedTable[n - 1][k - 1][m - 1];
+}
+
+// CPU DISPATCH
+
+static pthread_once_t select_once = PTHREAD_ONCE_INIT;
+static const MatMulImpl * selected;
+#if PRODUCT_WIDE
+static MatMulProductsKernel selected_products;
+#endif
+
+static void MatMulDetect()
+{
+  // the table is ordered slowest to fastest, keep the last supported entry
+  for (const MatMulImpl * impl = MatMulImpls; impl->name != NULL; impl++)
+    if (impl->supported())
+      selected = impl;
+#if PRODUCT_WIDE
+  selected_products = MatMulProductsBlocked;
+#if defined(__x86_64__) || defined(__i386__)
+  if (SupportsAVX2())
+    selected_products = MatMulProductsAVX2;
+#endif
+#endif
+}
+
+MatMulKernel MatMulSelect()
+{
+  pthread_once(&select_once, MatMulDetect);
+  return selected->kernel;
+}
+
+const char * MatMulSelectName()
+{
+  pthread_once(&select_once, MatMulDetect);
+  return selected->name;
+}
+
+void MatMul(const Element * a, const Element * b, Product * c, int n, int k, int m)
+{
+  if ((unsigned) (n - 1) < GEMM_UNROLL_MAX && (unsigned) (k - 1) < GEMM_UNROLL_MAX && (unsigned) (m - 1) < GEMM_UNROLL_MAX)
+    MatMulFixedTable[n - 1][k - 1][m - 1](a, b, c, n, k, m);
+  else if (m < GEMM_SMALL_COLS)
+    MatMulNaive(a, b, c, n, k, m);
+  else
+    MatMulSelect()(a, b, c, n, k, m);
+}
+
+void MatMulBatch(const Element * a, const Element * b, Product * c, int n, int k, int m, int count)
+{
+  pthread_once(&select_once, MatMulDetect);
+  selected->batch(a, b, c, n, k, m, count);
+}
+
+void MatMulProducts(const Product * a, const Product * b, Product * c, int n, int k, int m)
+{
+#if PRODUCT_WIDE
+  pthread_once(&select_once, MatMulDetect);
+  selected_products(a, b, c, n, k, m);
+#else
+  MatMul(a, b, c, n, k, m); // Products are Elements
+#endif
+}
@@ -0,0 +1,96 @@
+/*
+ *  matmul header
+ *  Function prototypes, data, and constants for matrix multiply kernels
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Cache blocking factors for the blocked kernels
+// A GEMM_BLOCK_K x GEMM_BLOCK_J panel of the right operand (128 KB) is
+// reused for every row of the left operand before moving on
+#define GEMM_BLOCK_K 128
+#define GEMM_BLOCK_J 256
+
+// Pairs of a batch summed together by the kernels that widen, see MatMulBatchScalar()
+#define GEMM_BATCH_RUN 64
+
+// The SSE4.1 and AVX2 intrinsics kernels multiply 32-bit integer lanes;
+// other element types get an AVX2 build of the widening loops instead
+#if (defined(__x86_64__) || defined(__i386__)) && MATRIX_ELEMENT == ELEMENT_INT32
+#define GEMM_SIMD 1
+#else
+#define GEMM_SIMD 0
+#endif
+
+// Results narrower than this many columns cannot fill a vector register,
+// MatMul() multiplies them with the plain loop instead
+#define GEMM_SMALL_COLS 8
+
+// Shapes with every dimension at most GEMM_UNROLL_MAX get a fully unrolled
+// kernel of their own, generated at compile time; 1 to 8, e.g.
+// make UNROLL=8
+#ifndef GEMM_UNROLL_MAX
+#define GEMM_UNROLL_MAX 4
+#endif
+
+// Multiply row-major a (n x k) by row-major b (k x m) into row-major c (n x m)
+// c must not alias a or b.  Products are stored as Products, integer
+// arithmetic wraps modulo their width like the original int loop, so every
+// kernel produces identical results; float products are summed in double.
+typedef void (*MatMulKernel)(const Element * a, const Element * b, Product * c, int n, int k, int m);
+
+// Multiply count independent n x k by k x m pairs held structure-of-arrays:
+// element e of pair p is a[e * count + p], and likewise for b and c, so the
+// inner loop runs across the pairs and fills vector registers at any shape
+typedef void (*MatMulBatchKernel)(const Element * a, const Element * b, Product * c, int n, int k, int m, int count);
+
+// Multiply operands that are Products themselves, as chain intermediates are
+typedef void (*MatMulProductsKernel)(const Product * a, const Product * b, Product * c, int n, int k, int m);
+
+// A kernel and its batched form, with a check that the running CPU can execute them
+typedef struct matmul_impl {
+  const char * name;
+  MatMulKernel kernel;
+  MatMulBatchKernel batch;
+  int (*supported)();
+} MatMulImpl;
+
+// All kernels compiled into this binary, fastest last, terminated by a NULL name
+extern const MatMulImpl MatMulImpls[];
+
+// KERNELS
+void MatMulNaive(const Element * a, const Element * b, Product * c, int n, int k, int m);
+void MatMulBlocked(const Element * a, const Element * b, Product * c, int n, int k, int m);
+void MatMulBatchScalar(const Element * a, const Element * b, Product * c, int n, int k, int m, int count);
+#if GEMM_SIMD
+void MatMulSSE41(const Element * a, const Element * b, Product * c, int n, int k, int m);
+void MatMulBatchSSE41(const Element * a, const Element * b, Product * c, int n, int k, int m, int count);
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+void MatMulAVX2(const Element * a, const Element * b, Product * c, int n, int k, int m);
+void MatMulBatchAVX2(const Element * a, const Element * b, Product * c, int n, int k, int m, int count);
+#endif
+#if PRODUCT_WIDE
+void MatMulProductsBlocked(const Product * a, const Product * b, Product * c, int n, int k, int m);
+#if defined(__x86_64__) || defined(__i386__)
+void MatMulProductsAVX2(const Product * a, const Product * b, Product * c, int n, int k, int m);
+#endif
+#endif
+
+// Unrolled kernel for an n x k by k x m multiply, NULL if the shape is too large
+MatMulKernel MatMulFixed(int n, int k, int m);
+
+// Fastest kernel supported by this CPU, detected once
+MatMulKernel MatMulSelect();
+const char * MatMulSelectName();
+
+// Multiply with the best kernel for this CPU and shape, unrolled for small shapes
+void MatMul(const Element * a, const Element * b, Product * c, int n, int k, int m);
+
+// Multiply a structure-of-arrays batch of pairs with the best kernel for this CPU
+void MatMulBatch(const Element * a, const Element * b, Product * c, int n, int k, int m, int count);
+
+// Multiply Products with the best kernel for this CPU, the same as MatMul()
+// unless Product is wider than Element
+void MatMulProducts(const Product * a, const Product * b, Product * c, int n, int k, int m);
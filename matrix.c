@@ -15,64 +15,333 @@
 #include <sched.h>
 #include <string.h>
 #include <time.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "element.h"
 #include "matrix.h"
+#include "matmul.h"
+#include "mulpool.h"
 #include "pcmatrix.h"
 
 
-// MATRIX ROUTINES
-Matrix * AllocMatrix(int r, int c)
+// MATRIX POOL
+// Freed matrices are kept on free lists by size class.  Each thread has
+// its own lists so the common case takes no lock; consumers free far more
+// than they allocate and producers the reverse, so lists spill to and
+// refill from a shared pool POOL_BATCH matrices at a time.  There is a
+// shared pool per NUMA node, so pinned workers only recycle memory that
+// lives on their own node.
+
+// Size of the header in front of the element data
+#define MATRIX_HEADER_SIZE ((sizeof(Matrix) + MATRIX_ALIGN - 1) & ~(size_t) (MATRIX_ALIGN - 1))
+
+typedef struct pool_list {
+  Matrix * head;
+  int count;
+} PoolList;
+
+// shared free lists per node, one lock per size class
+static pthread_mutex_t pool_lock[POOL_NODES][POOL_CLASSES] = {
+  [0 ... POOL_NODES - 1] = { [0 ... POOL_CLASSES - 1] = PTHREAD_MUTEX_INITIALIZER }
+};
+static PoolList pool_global[POOL_NODES][POOL_CLASSES];
+
+// this thread's free lists, and the node they belong to
+static __thread PoolList pool_local[POOL_CLASSES];
+static __thread int pool_node = 0;
+
+// smallest size class holding elems elements
+static int PoolClass(size_t elems)
 {
-  Matrix * mat;
-  mat = (Matrix *) malloc(sizeof(Matrix));
-  int ** a;
-  int i;
-  a = (int**) malloc(sizeof(int *) * r);
-  assert(a != 0);
-  for (i = 0; i < r; i++)
+  int k = 0;
+  while (((size_t) 1 << k) < elems)
+    k++;
+  assert(k < POOL_CLASSES);
+  return k;
+}
+
+// move up to n matrices from list src to list dst
+static void PoolMove(PoolList * src, PoolList * dst, int n)
+{
+  while (n-- > 0 && src->head != NULL)
+  {
+    Matrix * mat = src->head;
+    src->head = mat->next;
+    src->count--;
+    mat->next = dst->head;
+    dst->head = mat;
+    dst->count++;
+  }
+}
+
+// take a matrix of class k from the pool, NULL if none is free
+static Matrix * PoolTake(int k)
+{
+  PoolList * local = &pool_local[k];
+  if (local->head == NULL)
+  {
+    // refill this thread's list from its node's shared pool
+    pthread_mutex_lock(&pool_lock[pool_node][k]);
+    PoolMove(&pool_global[pool_node][k], local, POOL_BATCH);
+    pthread_mutex_unlock(&pool_lock[pool_node][k]);
+    if (local->head == NULL)
+      return NULL;
+  }
+  Matrix * mat = local->head;
+  local->head = mat->next;
+  local->count--;
+  return mat;
+}
+
+// return a matrix to the pool, frees it if the pool is full
+static void PoolGive(Matrix * mat)
+{
+  int k = mat->pool_class;
+  if (mat->node != pool_node)
+  {
+    // memory from another node goes straight back to that node's pool
+    pthread_mutex_lock(&pool_lock[mat->node][k]);
+    int full = pool_global[mat->node][k].count >= POOL_GLOBAL_LIMIT;
+    if (!full)
+    {
+      mat->next = pool_global[mat->node][k].head;
+      pool_global[mat->node][k].head = mat;
+      pool_global[mat->node][k].count++;
+    }
+    pthread_mutex_unlock(&pool_lock[mat->node][k]);
+    if (full)
+      free(mat);
+    return;
+  }
+  PoolList * local = &pool_local[k];
+  mat->next = local->head;
+  local->head = mat;
+  local->count++;
+  if (local->count > POOL_LOCAL_LIMIT)
+  {
+    // spill a batch to the shared pool, anything over its limit goes back to the heap
+    pthread_mutex_lock(&pool_lock[pool_node][k]);
+    int room = POOL_GLOBAL_LIMIT - pool_global[pool_node][k].count;
+    PoolMove(local, &pool_global[pool_node][k], room < POOL_BATCH ? room : POOL_BATCH);
+    pthread_mutex_unlock(&pool_lock[pool_node][k]);
+    while (local->count > POOL_LOCAL_LIMIT)
+    {
+      Matrix * extra = local->head;
+      local->head = extra->next;
+      local->count--;
+      free(extra);
+    }
+  }
+}
+
+// Hand this thread's free matrices to the shared pool, call before a worker exits
+void MatrixPoolThreadFlush()
+{
+  for (int k = 0; k < POOL_CLASSES; k++)
+  {
+    if (pool_local[k].head == NULL)
+      continue;
+    pthread_mutex_lock(&pool_lock[pool_node][k]);
+    PoolMove(&pool_local[k], &pool_global[pool_node][k], pool_local[k].count);
+    pthread_mutex_unlock(&pool_lock[pool_node][k]);
+  }
+}
+
+// Make the calling thread allocate from and recycle into node's pool,
+// call before the thread allocates any matrix
+void MatrixPoolSetNode(int node)
+{
+  MatrixPoolThreadFlush();
+  pool_node = node % POOL_NODES;
+}
+
+// Release every pooled matrix back to the heap, call once all workers are done
+void MatrixPoolDestroy()
+{
+  MatrixPoolThreadFlush();
+  for (int n = 0; n < POOL_NODES; n++)
+    for (int k = 0; k < POOL_CLASSES; k++)
+    {
+      pthread_mutex_lock(&pool_lock[n][k]);
+      while (pool_global[n][k].head != NULL)
+      {
+        Matrix * mat = pool_global[n][k].head;
+        pool_global[n][k].head = mat->next;
+        free(mat);
+      }
+      pool_global[n][k].count = 0;
+      pthread_mutex_unlock(&pool_lock[n][k]);
+    }
+}
+
+// PROCESS MODE
+// A worker process of process mode allocates the matrices it hands to
+// other processes from shared memory, and gives them back there
+static Matrix * (*shared_alloc)(int r, int c); // NULL - allocate from the pool or the heap
+static void (*shared_release)(Matrix * mat);
+
+// Make this process allocate matrices with alloc, NULL for the pool, and
+// free MATRIX_SHARED matrices with release
+void MatrixSetShared(Matrix * (*alloc)(int r, int c), void (*release)(Matrix * mat))
+{
+  shared_alloc = alloc;
+  shared_release = release;
+}
+
+// A matrix from the pool or the heap with room for elems Elements
+static Matrix * AllocElements(size_t elems)
+{
+  int k = PoolClass(elems);
+  Matrix * mat = NULL;
+  if (MATRIX_POOL)
+    mat = PoolTake(k);
+  if (mat == NULL)
   {
-    a[i] = (int *) malloc(c * sizeof(int));
-    assert(a[i] != 0);
+    // header and room for 2^k elements in a single aligned block
+    size_t bytes = MATRIX_HEADER_SIZE + (sizeof(Element) << k);
+    bytes = (bytes + MATRIX_ALIGN - 1) & ~(size_t) (MATRIX_ALIGN - 1);
+    mat = (Matrix *) aligned_alloc(MATRIX_ALIGN, bytes);
+    assert(mat != 0);
+    mat->pool_class = k;
+    mat->node = pool_node; // first touched by this thread, so it lives on this thread's node
+    mat->data = (Element *) ((char *) mat + MATRIX_HEADER_SIZE);
   }
-  mat->m=a;
+  mat->next = NULL;
+  return mat;
+}
+
+// MATRIX ROUTINES
+Matrix * AllocMatrix(int r, int c)
+{
+  if (shared_alloc != NULL)
+    return shared_alloc(r, c); // built in place in shared memory
+  Matrix * mat = AllocElements((size_t) r * c);
+  mat->rows=r;
+  mat->cols=c;
+  return mat;
+}
+
+// A matrix for an r x c product, its elements are mat->product
+// Products stay in the process that computed them, never in shared memory
+Matrix * AllocProduct(int r, int c)
+{
+  Matrix * mat = AllocElements(((size_t) r * c * sizeof(Product) + sizeof(Element) - 1) / sizeof(Element));
   mat->rows=r;
   mat->cols=c;
   return mat;
 }
 
+// Wrap r x c elements that live elsewhere in a matrix without copying them
+Matrix * MatrixMapped(int r, int c, Element * data)
+{
+  Matrix * mat = (Matrix *) malloc(sizeof(Matrix));
+  assert(mat != 0);
+  mat->rows = r;
+  mat->cols = c;
+  mat->pool_class = MATRIX_MAPPED;
+  mat->node = 0;
+  mat->next = NULL;
+  mat->data = data;
+  return mat;
+}
+
 void FreeMatrix(Matrix * mat)
 {
-  int r = mat->rows;
-  //int c = mat->cols;
-  int **a = mat->m;
-  int i;
-  for (i=0; i<r; i++)
-  {
-    free(a[i]);
-  }
-  free(a);
-  free(mat);
+  if (mat->pool_class == MATRIX_MAPPED)
+    free(mat); // the elements belong to the mapping
+  else if (mat->pool_class == MATRIX_SHARED)
+    shared_release(mat);
+  else if (MATRIX_POOL)
+    PoolGive(mat);
+  else
+    free(mat);
+}
+
+// RANDOM NUMBERS
+// Every thread owns a xoshiro128** generator, so producers never share
+// the libc rand() lock.  A producer seeds its generator from the run seed
+// and its index, giving each one its own reproducible stream; any other
+// thread that generates matrices gets a stream of its own on first use.
+
+static __thread uint32_t rng_state[4];
+static __thread int rng_seeded = 0;
+static _Atomic int rng_next_stream = RNG_LAZY_STREAM; // streams for threads that never called MatrixSeedThread()
+
+// splitmix64, expands a seed into well mixed generator state
+static uint64_t SplitMix64(uint64_t * x)
+{
+  uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+// Seed the calling thread's generator with stream number stream of seed
+void MatrixSeedThread(unsigned long seed, int stream)
+{
+  uint64_t x = (uint64_t) seed ^ ((uint64_t) stream * 0xd1b54a32d192ed03ULL);
+  uint64_t a = SplitMix64(&x);
+  uint64_t b = SplitMix64(&x);
+  rng_state[0] = (uint32_t) a;
+  rng_state[1] = (uint32_t) (a >> 32);
+  rng_state[2] = (uint32_t) b;
+  rng_state[3] = (uint32_t) (b >> 32);
+  rng_seeded = 1;
+}
+
+static inline uint32_t Rotl(uint32_t x, int k)
+{
+  return (x << k) | (x >> (32 - k));
+}
+
+// xoshiro128** next output
+static inline uint32_t RngNext()
+{
+  uint32_t * s = rng_state;
+  uint32_t result = Rotl(s[1] * 5, 7) * 9;
+  uint32_t t = s[1] << 9;
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = Rotl(s[3], 11);
+  return result;
+}
+
+static inline void RngEnsureSeeded()
+{
+  if (!rng_seeded)
+    MatrixSeedThread(RANDOM_SEED, atomic_fetch_add(&rng_next_stream, 1));
+}
+
+// uniform integer in [0, n), multiply-shift range reduction
+static inline int RngBelow(int n)
+{
+  return (int) (((uint64_t) RngNext() * (uint32_t) n) >> 32);
 }
 
 void GenMatrix(Matrix * mat)
 {
-  int height = mat->rows;
-  int width = mat->cols;
-  int ** a = mat->m;
-  int i, j;
-  for (i = 0; i < height; i++)
+  int count = mat->rows * mat->cols;
+  Element * mm = mat->data;
+  int i;
+  // the elements are contiguous, fill the whole matrix in one pass
+  if (MATRIX_MODE == 0)
   {
-    for (j = 0; j < width; j++)
-    {
-      int * mm = a[i];
-      if (MATRIX_MODE == 0)
-        mm[j] = 1 + rand() % 10;
-      else
-        mm[j] = 1;
+    RngEnsureSeeded();
+    for (i = 0; i < count; i++)
+      mm[i] = 1 + RngBelow(10);
+  }
+  else
+  {
+    for (i = 0; i < count; i++)
+      mm[i] = 1;
+  }
 #if OUTPUT
-      printf("matrix[%d][%d]=%d \n",i,j,mm[j]);
+  for (i = 0; i < count; i++)
+    printf("matrix[%d][%d]=" ELEMENT_FORMAT " \n",i / mat->cols,i % mat->cols,mm[i]);
 #endif
-    }
-  }
 }
 
 Matrix * GenMatrixRandom()
@@ -81,8 +350,9 @@ Matrix * GenMatrixRandom()
   int col;
   if (MATRIX_MODE ==0)
   {
-    row = 1 + rand() % 4;
-    col = 1 + rand() % 4;
+    RngEnsureSeeded();
+    row = 1 + RngBelow(RANDOM_MAX_DIM);
+    col = 1 + RngBelow(RANDOM_MAX_DIM);
   }
   else
   {
@@ -106,98 +376,79 @@ Matrix * MatrixMultiply(Matrix * m1, Matrix * m2)
 {
   if ((m1==NULL) || (m2==NULL))
     printf("m1=%p  m2=%p!\n",m1,m2);
-  int sum=0;
   if (m1->cols != m2->rows)
   {
     return NULL;
   }
-  printf("MULTIPLY (%d x %d) BY (%d x %d):\n",m1->rows,m1->cols,m2->rows,m2->cols);
-  Matrix * newmat = AllocMatrix(m1->rows, m2->cols);
-  int ** nm = newmat->m;
-  int ** ma1 = m1->m;
-  int ** ma2 = m2->m;
-  for (int c=0;c<newmat->rows;c++)
-  {
-    for (int d=0;d<newmat->cols;d++)
-    {
-      for (int k=0;k<m2->rows;k++)
-      {
-        sum = sum + ma1[c][k]*ma2[k][d];
-      }
-      nm[c][d] = sum;
-      sum=0;
-    }
-  }
+  Matrix * newmat = AllocProduct(m1->rows, m2->cols);
+  mulpool_multiply(m1->data, m2->data, newmat->product, m1->rows, m1->cols, m2->cols); // best kernel, shared with the pool if large
   return newmat;
 }
 
 void DisplayMatrix(Matrix * mat, FILE *stream)
 {
-  if ((mat == NULL) || (mat->m == NULL))
+  if ((mat == NULL) || (mat->data == NULL))
   {
     printf("DisplayMatrix: EMPTY matrix\n");
     return;
   }
-  int ** matrix = mat->m;
   int height = mat->rows;
   int width = mat->cols;
-  int y=0;
+  Element y=0;
   int i, j;
   for (i=0; i<height; i++)
   {
-    int *mm = matrix[i];
+    Element *mm = &mat->data[i * width];
     fprintf(stream, "|");
     for (j=0; j<width; j++)
     {
       y=mm[j];
       if (j==0)
-        fprintf(stream, "%3d",y);
+        fprintf(stream, ELEMENT_FORMAT,y);
       else
-        fprintf(stream, " %3d",y);
+        fprintf(stream, " " ELEMENT_FORMAT,y);
     }
     fprintf(stream, "|\n");
   }
 }
 
 
-int AvgElement(Matrix * mat) // int ** matrix, const int height, const int width)
+long AvgElement(Matrix * mat) // int ** matrix, const int height, const int width)
 {
-  int ** a = mat->m;
   int height = mat->rows;
   int width = mat->cols;
-  int x=0;
-  int y=0;
+  long x=0;
+  long y=0;
   int ele=0;
   int i, j;
   for (i=0; i<height; i++)
     for (j=0; j<width; j++)
     {
-      int *mm = a[i];
-      y=mm[j];
+      Element *mm = &mat->data[i * width];
+      y=(long) mm[j];
       x=x+y;
       ele++;
 #if OUTPUT
-      printf("[%d][%d]--%d x=%d ele=%d\n",i,j,mm[j],x,ele);
+      printf("[%d][%d]--%ld x=%ld ele=%d\n",i,j,y,x,ele);
 #endif
     }
-  printf("x=%d ele=%d\n",x, ele);
+  printf("x=%ld ele=%d\n",x, ele);
   return x / ele;
 }
 
-int SumMatrix(Matrix * mat) {
-   int ** a = mat->m;
+long SumMatrix(Matrix * mat) {
    int height = mat->rows;
    int width = mat->cols;
    int i =0;
    int j =0;
-   int y =0;
-   int total = 0;
+   long y =0;
+   long total = 0;
    for (i = 0; i < height; i++)
    {
       for (j = 0; j < width; j++)
       {
-	  int *mm = a[i];
-	  y=mm[j];
+	  Element *mm = &mat->data[i * width];
+	  y=(long) mm[j];
 	  total = total+y;
       }
    }
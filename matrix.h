@@ -9,21 +9,71 @@
 #define ROW 5
 #define COL 5
 
+// Alignment of matrix allocations and of the element data
+#define MATRIX_ALIGN 64
+
+// Matrix pool limits
+// POOL_CLASSES      - number of size classes, class k holds 2^k elements
+// POOL_LOCAL_LIMIT  - free matrices a thread keeps per class before spilling
+// POOL_BATCH        - matrices moved between a thread and the shared pool at once
+// POOL_GLOBAL_LIMIT - free matrices kept per class in the shared pool
+// POOL_NODES        - NUMA nodes with a shared pool of their own
+#define POOL_CLASSES 32
+#define POOL_LOCAL_LIMIT 64
+#define POOL_BATCH 32
+#define POOL_GLOBAL_LIMIT 4096
+#define POOL_NODES 8
+
+// A matrix is one contiguous allocation: this header, padded to
+// MATRIX_ALIGN, followed by rows * cols row-major elements; those of a
+// product, see AllocProduct(), are Products
 typedef struct matrix {
   int rows;
   int cols;
-  int ** m;
+  int pool_class; // size class of the allocation, room for 2^pool_class elements
+  int node; // NUMA node of the thread that allocated it, selects its shared pool
+  struct matrix * next; // free list link in the pool, partner link between pipeline stages
+  unsigned long born; // when it was generated, ns, with --latency
+  unsigned long enqueued; // when it was put into the buffer, ns, with --latency
+  union {
+    Element * data; // row-major elements, element (i,j) is data[i * cols + j]
+    Product * product; // the same for a product
+  };
 } Matrix;
 
 //extern int theseed;
 
+// pool_class of a matrix whose elements live outside its allocation,
+// e.g. in a mapped input file; freeing it releases only the header
+#define MATRIX_MAPPED -1
+
+// pool_class of a matrix living in a slot of the shared-memory segment of
+// process mode; freeing it hands the slot back to the segment
+#define MATRIX_SHARED -2
+
+// Random matrices (matrix mode 0) have 1 to RANDOM_MAX_DIM rows and columns
+#define RANDOM_MAX_DIM 4
+
+// First stream number handed to threads that generate matrices without
+// calling MatrixSeedThread(), well clear of producer indices
+#define RNG_LAZY_STREAM 0x10000
+
 // MATRIX ROUTINES
 Matrix * AllocMatrix(int r, int c);
+Matrix * AllocProduct(int r, int c);
+Matrix * MatrixMapped(int r, int c, Element * data);
 void FreeMatrix(Matrix * mat);
+void MatrixSeedThread(unsigned long seed, int stream);
 void GenMatrix(Matrix * mat);
 Matrix * GenMatrixRandom();
-int AvgElement(Matrix * mat);
-int SumMatrix(Matrix * mat);
+long AvgElement(Matrix * mat);
+long SumMatrix(Matrix * mat);
 Matrix * MatrixMultiply(Matrix * m1, Matrix * m2);
 void DisplayMatrix(Matrix * mat, FILE *stream);
 Matrix * GenMatrixBySize(int row, int col);
+
+// MATRIX POOL ROUTINES
+void MatrixPoolSetNode(int node);
+void MatrixPoolThreadFlush();
+void MatrixPoolDestroy();
+void MatrixSetShared(Matrix * (*alloc)(int r, int c), void (*release)(Matrix * mat));
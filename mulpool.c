@@ -0,0 +1,175 @@
+/*
+ *  mulpool module
+ *  Shared thread pool for multiplying single large matrices in parallel
+ *
+ *  A consumer whose product needs at least MUL_THRESHOLD multiply-adds
+ *  posts it as a job.  Idle pool threads join in, and every participant,
+ *  the consumer included, repeatedly claims the next range of result rows
+ *  and multiplies it with the usual kernel.  The consumer returns once the
+ *  last helper has left the job.  The pool is sized to the CPUs the
+ *  producers and consumers leave free, so it does not oversubscribe them.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <pthread.h>
+#include "element.h"
+#include "matmul.h"
+#include "mulpool.h"
+#include "pcmatrix.h"
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER; // pool threads wait here for jobs
+static pthread_cond_t finished = PTHREAD_COND_INITIALIZER; // posters wait here for their helpers
+static MulJob * jobs; // jobs with rows left to hand out, oldest first
+static pthread_t * threads;
+static int nthreads;
+static int stopping;
+
+// claim and multiply row ranges of job until none are left
+static void mulpool_run(MulJob * job)
+{
+  int r;
+  while ((r = atomic_fetch_add(&job->next, job->rows)) < job->n) {
+    int rows = job->n - r < job->rows ? job->n - r : job->rows;
+    if (job->products)
+      MatMulProducts((const Product *) job->a + (size_t) r * job->k, job->b, job->c + (size_t) r * job->m, rows, job->k, job->m);
+    else
+      MatMul((const Element *) job->a + (size_t) r * job->k, job->b, job->c + (size_t) r * job->m, rows, job->k, job->m);
+  }
+}
+
+// remove job from the list if it is still there, lock must be held
+static void mulpool_unlink(MulJob * job)
+{
+  for (MulJob ** p = &jobs; *p != NULL; p = &(*p)->link)
+    if (*p == job) {
+      *p = job->link;
+      return;
+    }
+}
+
+static void *mulpool_worker(void *arg)
+{
+  pthread_mutex_lock(&lock);
+  for (;;) {
+    while (!stopping && jobs == NULL)
+      pthread_cond_wait(&work, &lock);
+    if (stopping)
+      break;
+    MulJob * job = jobs;
+    job->helpers++;
+    pthread_mutex_unlock(&lock);
+    mulpool_run(job);
+    pthread_mutex_lock(&lock);
+    mulpool_unlink(job); // every row has been handed out
+    if (--job->helpers == 0)
+      pthread_cond_broadcast(&finished);
+  }
+  pthread_mutex_unlock(&lock);
+  return NULL;
+}
+
+// Pool threads mulpool_start() would start: count, or one per CPU not
+// taken by the workers producers and consumers when count < 0
+int mulpool_size(int count, int workers)
+{
+  if (count < 0) {
+    cpu_set_t allowed;
+    int ncpus = sched_getaffinity(0, sizeof(allowed), &allowed) == 0 ? CPU_COUNT(&allowed) : 1;
+    count = ncpus - workers;
+    if (count < 0)
+      count = 0;
+  }
+  return count;
+}
+
+// Start count pool threads, see mulpool_size(); returns the number started
+int mulpool_start(int count, int workers)
+{
+  count = mulpool_size(count, workers);
+  stopping = 0;
+  jobs = NULL;
+  nthreads = count;
+  threads = (pthread_t *) malloc(sizeof(pthread_t) * (count > 0 ? count : 1));
+  for (int i = 0; i < count; i++)
+    pthread_create(&threads[i], NULL, mulpool_worker, NULL);
+  return count;
+}
+
+// Stop the pool threads, no multiply may be in progress
+void mulpool_stop()
+{
+  pthread_mutex_lock(&lock);
+  stopping = 1;
+  pthread_cond_broadcast(&work);
+  pthread_mutex_unlock(&lock);
+  for (int i = 0; i < nthreads; i++)
+    pthread_join(threads[i], NULL);
+  free(threads);
+  threads = NULL;
+  nthreads = 0;
+}
+
+// Whether an n x k by k x m multiply is large enough to share with the pool
+static inline int mulpool_worth(int n, int k, int m)
+{
+  return nthreads > 0 && (long) n * k * m >= MUL_THRESHOLD && n >= 2 * MULPOOL_MIN_ROWS;
+}
+
+// Post job, work on it with the pool and return once it is done
+static void mulpool_share(MulJob * job)
+{
+  job->helpers = 0;
+  job->link = NULL;
+  job->rows = job->n / ((nthreads + 1) * MULPOOL_SPLIT);
+  if (job->rows < MULPOOL_MIN_ROWS)
+    job->rows = MULPOOL_MIN_ROWS;
+  atomic_init(&job->next, 0);
+
+  // post the job behind any others and wake the pool
+  pthread_mutex_lock(&lock);
+  MulJob ** p = &jobs;
+  while (*p != NULL)
+    p = &(*p)->link;
+  *p = job;
+  pthread_cond_broadcast(&work);
+  pthread_mutex_unlock(&lock);
+
+  mulpool_run(job); // work on our own product too
+
+  // the job lives on the caller's stack, wait until no helper is still using it
+  pthread_mutex_lock(&lock);
+  mulpool_unlink(job);
+  while (job->helpers > 0)
+    pthread_cond_wait(&finished, &lock);
+  pthread_mutex_unlock(&lock);
+}
+
+// Multiply row-major a (n x k) by b (k x m) into c, sharing the rows with
+// the pool when the product is large enough to be worth it
+void mulpool_multiply(const Element * a, const Element * b, Product * c, int n, int k, int m)
+{
+  if (!mulpool_worth(n, k, m)) {
+    MatMul(a, b, c, n, k, m);
+    return;
+  }
+  MulJob job = { .a = a, .b = b, .c = c, .products = 0, .n = n, .k = k, .m = m };
+  mulpool_share(&job);
+}
+
+// The same for operands that are Products, see MatMulProducts()
+void mulpool_multiply_products(const Product * a, const Product * b, Product * c, int n, int k, int m)
+{
+  if (!mulpool_worth(n, k, m)) {
+    MatMulProducts(a, b, c, n, k, m);
+    return;
+  }
+  MulJob job = { .a = a, .b = b, .c = c, .products = 1, .n = n, .k = k, .m = m };
+  mulpool_share(&job);
+}
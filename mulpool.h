@@ -0,0 +1,37 @@
+/*
+ *  mulpool header
+ *  Function prototypes, data, and constants for the parallel multiply pool
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Chunks per participating thread a large multiply is cut into, so a
+// thread that falls behind does not hold up the whole product
+#define MULPOOL_SPLIT 4
+
+// Fewest rows of the result handed out as one chunk
+#define MULPOOL_MIN_ROWS 4
+
+// One multiply shared with the pool, row ranges of c are handed out in turn
+// a, b     - Elements, or Products when products is set
+// next     - first row not yet handed out
+// helpers  - pool threads currently working on this job
+typedef struct mul_job {
+  const void * a;
+  const void * b;
+  Product * c;
+  int products;
+  int n, k, m;
+  int rows; // rows per chunk
+  _Atomic int next;
+  int helpers;
+  struct mul_job * link;
+} MulJob;
+
+// mulpool methods
+int mulpool_size(int count, int workers);
+int mulpool_start(int count, int workers);
+void mulpool_stop();
+void mulpool_multiply(const Element * a, const Element * b, Product * c, int n, int k, int m);
+void mulpool_multiply_products(const Product * a, const Product * b, Product * c, int n, int k, int m);
@@ -0,0 +1,334 @@
+/*
+ *  output module
+ *  Asynchronous, buffered output of multiplication results
+ *
+ *  Consumers format their results into private chunks and hand full
+ *  chunks to a single writer thread, which writes everything queued with
+ *  one writev() call.  Consumers never touch the stdout FILE lock, and
+ *  the results of one multiplication stay together as long as they fit
+ *  in a chunk.  A fixed number of chunks circulates between consumers and
+ *  the writer, so a slow output file throttles consumers instead of
+ *  growing memory.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Include only libraries for this module
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "element.h"
+#include "matrix.h"
+#include "output.h"
+#include "pcmatrix.h"
+
+static int output_fd = -1; // file the writer thread writes to
+static pthread_t writer;
+static int writer_running = 0;
+static int writer_done = 0; // set by output_stop(), writer exits once the queue is empty
+
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queued = PTHREAD_COND_INITIALIZER; // writer waits here for chunks to write
+static pthread_cond_t freed = PTHREAD_COND_INITIALIZER; // consumers wait here for an empty chunk
+static OutputChunk * queue_head = NULL; // chunks waiting to be written, in order
+static OutputChunk * queue_tail = NULL;
+static OutputChunk * free_chunks = NULL; // empty chunks
+
+// write all cnt buffers, retrying on short writes
+static void write_fully(int fd, struct iovec * iov, int cnt)
+{
+  while (cnt > 0) {
+    ssize_t n = writev(fd, iov, cnt);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("output writev");
+      return;
+    }
+    // skip the iovecs written completely, trim the one written partly
+    while (cnt > 0 && (size_t) n >= iov->iov_len) {
+      n -= iov->iov_len;
+      iov++;
+      cnt--;
+    }
+    if (cnt > 0) {
+      iov->iov_base = (char *) iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+}
+
+// Writer thread, writes queued chunks in order until output_stop()
+static void * writer_worker(void * arg)
+{
+  struct iovec iov[OUTPUT_MAX_IOV];
+  OutputChunk * batch[OUTPUT_MAX_IOV];
+  for (;;) {
+    pthread_mutex_lock(&output_lock);
+    while (queue_head == NULL && !writer_done)
+      pthread_cond_wait(&queued, &output_lock);
+    if (queue_head == NULL) {
+      pthread_mutex_unlock(&output_lock);
+      break; // stopped and nothing left to write
+    }
+    // take everything queued, up to OUTPUT_MAX_IOV chunks
+    int cnt = 0;
+    while (queue_head != NULL && cnt < OUTPUT_MAX_IOV) {
+      batch[cnt] = queue_head;
+      queue_head = queue_head->next;
+      cnt++;
+    }
+    if (queue_head == NULL)
+      queue_tail = NULL;
+    pthread_mutex_unlock(&output_lock);
+
+    for (int i = 0; i < cnt; i++) {
+      iov[i].iov_base = batch[i]->data;
+      iov[i].iov_len = batch[i]->len;
+    }
+    write_fully(output_fd, iov, cnt);
+
+    // hand the chunks back to the consumers
+    pthread_mutex_lock(&output_lock);
+    for (int i = 0; i < cnt; i++) {
+      batch[i]->len = 0;
+      batch[i]->next = free_chunks;
+      free_chunks = batch[i];
+    }
+    pthread_cond_broadcast(&freed);
+    pthread_mutex_unlock(&output_lock);
+  }
+  return NULL;
+}
+
+// Start the writer thread on fd with enough chunks for nthreads consumers
+void output_start(int fd, int nthreads)
+{
+  int nchunks = OUTPUT_CHUNKS_PER_THREAD * (nthreads > 0 ? nthreads : 1) + 1;
+  for (int i = 0; i < nchunks; i++) {
+    OutputChunk * chunk = (OutputChunk *) malloc(sizeof(OutputChunk));
+    assert(chunk != 0);
+    chunk->len = 0;
+    chunk->next = free_chunks;
+    free_chunks = chunk;
+  }
+  output_fd = fd;
+  writer_done = 0;
+  writer_running = 1;
+  pthread_create(&writer, NULL, writer_worker, NULL);
+}
+
+// Write everything queued, stop the writer thread, and free the chunks
+// Every consumer must have called output_flush() first
+void output_stop()
+{
+  if (!writer_running)
+    return;
+  pthread_mutex_lock(&output_lock);
+  writer_done = 1;
+  pthread_cond_signal(&queued);
+  pthread_mutex_unlock(&output_lock);
+  pthread_join(writer, NULL);
+  writer_running = 0;
+  while (free_chunks != NULL) {
+    OutputChunk * chunk = free_chunks;
+    free_chunks = chunk->next;
+    free(chunk);
+  }
+}
+
+void output_init(OutputBuffer * ob)
+{
+  ob->chunk = NULL;
+}
+
+// Queue the current chunk, if it holds anything, and release it
+void output_flush(OutputBuffer * ob)
+{
+  OutputChunk * chunk = ob->chunk;
+  if (chunk == NULL)
+    return;
+  ob->chunk = NULL;
+  pthread_mutex_lock(&output_lock);
+  if (chunk->len == 0) {
+    chunk->next = free_chunks; // nothing to write, just give it back
+    free_chunks = chunk;
+    pthread_cond_signal(&freed);
+  }
+  else {
+    chunk->next = NULL;
+    if (queue_tail != NULL)
+      queue_tail->next = chunk;
+    else
+      queue_head = chunk;
+    queue_tail = chunk;
+    pthread_cond_signal(&queued);
+  }
+  pthread_mutex_unlock(&output_lock);
+}
+
+// Make sure at least n bytes fit in the current chunk, n <= OUTPUT_CHUNK_SIZE
+static char * output_reserve(OutputBuffer * ob, size_t n)
+{
+  if (ob->chunk != NULL && OUTPUT_CHUNK_SIZE - ob->chunk->len < n)
+    output_flush(ob);
+  if (ob->chunk == NULL) {
+    pthread_mutex_lock(&output_lock);
+    while (free_chunks == NULL)
+      pthread_cond_wait(&freed, &output_lock);
+    ob->chunk = free_chunks;
+    free_chunks = free_chunks->next;
+    pthread_mutex_unlock(&output_lock);
+    ob->chunk->len = 0;
+  }
+  return ob->chunk->data + ob->chunk->len;
+}
+
+// Append len bytes, splitting across chunks if needed
+static void output_append(OutputBuffer * ob, const void * src, size_t len)
+{
+  const char * p = (const char *) src;
+  while (len > 0) {
+    output_reserve(ob, 1);
+    size_t room = OUTPUT_CHUNK_SIZE - ob->chunk->len;
+    size_t n = len < room ? len : room;
+    memcpy(ob->chunk->data + ob->chunk->len, p, n);
+    ob->chunk->len += n;
+    p += n;
+    len -= n;
+  }
+}
+
+#if MATRIX_ELEMENT != ELEMENT_FLOAT
+// Format v like printf("%3ld") at dst, returns the number of characters written
+static int format_int3(char * dst, long v)
+{
+  char tmp[21];
+  int n = 0;
+  unsigned long u = v < 0 ? 0ul - (unsigned long) v : (unsigned long) v;
+  do {
+    tmp[n++] = '0' + u % 10;
+    u /= 10;
+  } while (u != 0);
+  if (v < 0)
+    tmp[n++] = '-';
+  int len = 0;
+  while (n + len < 3)
+    dst[len++] = ' ';
+  while (n > 0)
+    dst[len++] = tmp[--n];
+  return len;
+}
+#endif
+
+// Same text as DisplayMatrix(), for a product if product is set
+static void output_text_matrix(OutputBuffer * ob, Matrix * mat, int product)
+{
+  int width = mat->cols;
+  for (int i = 0; i < mat->rows; i++) {
+    size_t row = (size_t) i * width;
+    char * p = output_reserve(ob, 1);
+    *p = '|';
+    ob->chunk->len++;
+    for (int j = 0; j < width; j++) {
+      p = output_reserve(ob, 24);
+      int len = 0;
+      if (j != 0)
+        p[len++] = ' ';
+#if MATRIX_ELEMENT == ELEMENT_FLOAT
+      double v = product ? mat->product[row + j] : mat->data[row + j];
+      len += snprintf(p + len, 23, ELEMENT_FORMAT, v);
+#else
+      long v = product ? (long) mat->product[row + j] : (long) mat->data[row + j];
+      len += format_int3(p + len, v);
+#endif
+      ob->chunk->len += len;
+    }
+    output_append(ob, "|\n", 2);
+  }
+}
+
+// Append a matrix in the binary record format, a product if product is set
+void output_matrix_record(OutputBuffer * ob, Matrix * mat, int product)
+{
+  int size = product ? sizeof(Product) : sizeof(Element);
+  MatrixRecordHeader hdr = { mat->rows, mat->cols, size, 0 };
+  output_append(ob, &hdr, sizeof(hdr));
+  output_append(ob, mat->data, size * (size_t) mat->rows * mat->cols);
+}
+
+// Emit the result of m1 x m2 = m3 in the format selected by RESULT_OUTPUT
+void output_result(OutputBuffer * ob, Matrix * m1, Matrix * m2, Matrix * m3)
+{
+  if (RESULT_OUTPUT == RESULT_QUIET)
+    return;
+  if (RESULT_OUTPUT == RESULT_BINARY) {
+    // one record per matrix: m1, m2, then their product
+    output_matrix_record(ob, m1, 0);
+    output_matrix_record(ob, m2, 0);
+    output_matrix_record(ob, m3, 1);
+    return;
+  }
+  if (RESULT_OUTPUT == RESULT_PRODUCTS) {
+    output_matrix_record(ob, m3, 1); // a stream that can be replayed with --input
+    return;
+  }
+  // keep the whole block in one chunk when it fits
+  size_t estimate = 64 + 16 * ((size_t) m1->rows * (m1->cols + 1) + (size_t) m2->rows * (m2->cols + 1) + (size_t) m3->rows * (m3->cols + 1));
+  if (estimate <= OUTPUT_CHUNK_SIZE)
+    output_reserve(ob, estimate);
+  char line[96];
+  int len = snprintf(line, sizeof(line), "MULTIPLY (%d x %d) BY (%d x %d):\n", m1->rows, m1->cols, m2->rows, m2->cols);
+  output_append(ob, line, len);
+  output_text_matrix(ob, m1, 0);
+  output_append(ob, "    X\n", 6);
+  output_text_matrix(ob, m2, 0);
+  output_append(ob, "    =\n", 6);
+  output_text_matrix(ob, m3, 1);
+  output_append(ob, "\n", 1);
+}
+
+// Emit the product of a chain of n matrices in the format selected by RESULT_OUTPUT
+void output_chain(OutputBuffer * ob, Matrix ** items, int n, Matrix * product)
+{
+  if (RESULT_OUTPUT == RESULT_QUIET)
+    return;
+  if (RESULT_OUTPUT == RESULT_BINARY) {
+    // one record per matrix: the chain in order, then its product
+    for (int i = 0; i < n; i++)
+      output_matrix_record(ob, items[i], 0);
+    output_matrix_record(ob, product, 1);
+    return;
+  }
+  if (RESULT_OUTPUT == RESULT_PRODUCTS) {
+    output_matrix_record(ob, product, 1);
+    return;
+  }
+  size_t estimate = 64 + 16 * n + 16 * (size_t) product->rows * (product->cols + 1);
+  for (int i = 0; i < n; i++)
+    estimate += 16 * (size_t) items[i]->rows * (items[i]->cols + 1);
+  if (estimate <= OUTPUT_CHUNK_SIZE)
+    output_reserve(ob, estimate);
+  char line[96];
+  int len = snprintf(line, sizeof(line), "MULTIPLY CHAIN OF %d (%d x %d)", n, items[0]->rows, items[0]->cols);
+  output_append(ob, line, len);
+  for (int i = 1; i < n; i++) {
+    len = snprintf(line, sizeof(line), " BY (%d x %d)", items[i]->rows, items[i]->cols);
+    output_append(ob, line, len);
+  }
+  output_append(ob, ":\n", 2);
+  for (int i = 0; i < n; i++) {
+    if (i != 0)
+      output_append(ob, "    X\n", 6);
+    output_text_matrix(ob, items[i], 0);
+  }
+  output_append(ob, "    =\n", 6);
+  output_text_matrix(ob, product, 1);
+  output_append(ob, "\n", 1);
+}
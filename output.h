@@ -0,0 +1,50 @@
+/*
+ *  output header
+ *  Function prototypes, data, and constants for the result output module
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// ASYNCHRONOUS RESULT OUTPUT
+
+// Size of one output chunk, the unit consumers hand to the writer thread
+#define OUTPUT_CHUNK_SIZE (64 * 1024)
+
+// Output chunks allocated per consumer thread
+#define OUTPUT_CHUNKS_PER_THREAD 4
+
+// Most chunks the writer passes to a single writev() call
+#define OUTPUT_MAX_IOV 64
+
+// A chunk of formatted output
+typedef struct output_chunk {
+  struct output_chunk * next;
+  size_t len;
+  char data[OUTPUT_CHUNK_SIZE];
+} OutputChunk;
+
+// A consumer thread's private output buffer
+typedef struct output_buffer {
+  OutputChunk * chunk; // chunk being filled, NULL until first use
+} OutputBuffer;
+
+// Binary matrix record: four int32 header fields followed by rows * cols
+// elements in row-major order, all in host byte order; elements are the
+// build's Element (int32 by default), or its Product for a product, so
+// records only replay in a build whose Element is as wide as size
+typedef struct matrix_record_header {
+  int rows;
+  int cols;
+  int size;   // bytes per element
+  int unused; // zero, keeps the elements 16 byte aligned
+} MatrixRecordHeader;
+
+// output methods
+void output_start(int fd, int nthreads);
+void output_stop();
+void output_init(OutputBuffer * ob);
+void output_flush(OutputBuffer * ob);
+void output_result(OutputBuffer * ob, Matrix * m1, Matrix * m2, Matrix * m3);
+void output_chain(OutputBuffer * ob, Matrix ** items, int n, Matrix * product);
+void output_matrix_record(OutputBuffer * ob, Matrix * mat, int product);
@@ -0,0 +1,111 @@
+/*
+ *  pairbatch module
+ *  Multiplies many tiny pairs of one shape at once
+ *
+ *  A 2x3 by 3x2 product cannot fill a vector register on its own.  A
+ *  consumer instead files each tiny compatible pair under its shape, and
+ *  once a shape has collected a batch the operands are gathered
+ *  structure-of-arrays (element e of every pair side by side) and
+ *  multiplied together, vectorized across the pairs.  The products are
+ *  then written and the whole batch freed in the order the pairs arrived.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+#include "counter.h"
+#include "element.h"
+#include "matrix.h"
+#include "matmul.h"
+#include "output.h"
+#include "instrument.h"
+#include "latency.h"
+#include "prodcache.h"
+#include "pairbatch.h"
+
+// Collect up to size pairs per shape, at most PAIRBATCH_MAX_PAIRS
+PairBatch * pairbatch_create(int size)
+{
+  PairBatch * pb = (PairBatch *) calloc(1, sizeof(PairBatch)); // every slot starts empty
+  assert(pb != 0);
+  pb->size = size < PAIRBATCH_MAX_PAIRS ? size : PAIRBATCH_MAX_PAIRS;
+  return pb;
+}
+
+// Multiply every pair in a slot of shape n x k by k x m into new products
+static void pairbatch_multiply(PairBatch * pb, PairSlot * slot, int n, int k, int m, Matrix ** products)
+{
+  int count = slot->count;
+  Element * a = pb->a, * b = pb->b;
+  Product * c = pb->c;
+  // gather the operands structure-of-arrays
+  for (int p = 0; p < count; p++) {
+    for (int e = 0; e < n * k; e++)
+      a[e * count + p] = slot->left[p]->data[e];
+    for (int e = 0; e < k * m; e++)
+      b[e * count + p] = slot->right[p]->data[e];
+  }
+  MatMulBatch(a, b, c, n, k, m, count);
+  // scatter the products into matrices of their own
+  for (int p = 0; p < count; p++) {
+    products[p] = AllocProduct(n, m);
+    for (int e = 0; e < n * m; e++)
+      products[p]->product[e] = c[e * count + p];
+  }
+}
+
+// Multiply, write and free every pair in a slot, in the order they were added
+static void pairbatch_run(PairBatch * pb, PairSlot * slot, int n, int k, int m, OutputBuffer * out)
+{
+  Matrix * products[PAIRBATCH_MAX_PAIRS];
+  if (slot->count == 0)
+    return;
+  INSTR_TIME(multiply_ns, pairbatch_multiply(pb, slot, n, k, m, products));
+  for (int p = 0; p < slot->count; p++) {
+    output_result(out, slot->left[p], slot->right[p], products[p]);
+    prodcache_insert(slot->left[p], slot->right[p], products[p]);
+  }
+  latency_done(slot->left, slot->count);
+  latency_done(slot->right, slot->count);
+  for (int p = 0; p < slot->count; p++) {
+    FreeMatrix(slot->left[p]);
+    FreeMatrix(slot->right[p]);
+    FreeMatrix(products[p]);
+  }
+  slot->count = 0;
+}
+
+// Take over the pair m1 x m2 if it is tiny enough to batch
+// Returns 1 if the pair was taken, it is then multiplied, written and freed
+// with the rest of its shape's batch; 0 if the caller has to multiply it
+int pairbatch_add(PairBatch * pb, Matrix * m1, Matrix * m2, OutputBuffer * out)
+{
+  int n = m1->rows, k = m1->cols, m = m2->cols;
+  if (pb->size < 2 || k != m2->rows || n > PAIRBATCH_MAX_DIM || k > PAIRBATCH_MAX_DIM || m > PAIRBATCH_MAX_DIM)
+    return 0;
+  PairSlot * slot = &pb->slots[n - 1][k - 1][m - 1];
+  slot->left[slot->count] = m1;
+  slot->right[slot->count] = m2;
+  if (++slot->count == pb->size)
+    pairbatch_run(pb, slot, n, k, m, out);
+  return 1;
+}
+
+// Multiply and write every pending pair, whatever the size of its batch
+void pairbatch_flush(PairBatch * pb, OutputBuffer * out)
+{
+  for (int n = 1; n <= PAIRBATCH_MAX_DIM; n++)
+    for (int k = 1; k <= PAIRBATCH_MAX_DIM; k++)
+      for (int m = 1; m <= PAIRBATCH_MAX_DIM; m++)
+        pairbatch_run(pb, &pb->slots[n - 1][k - 1][m - 1], n, k, m, out);
+}
+
+// Free the batch, pairbatch_flush() must have emptied it
+void pairbatch_destroy(PairBatch * pb)
+{
+  free(pb);
+}
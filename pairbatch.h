@@ -0,0 +1,40 @@
+/*
+ *  pairbatch header
+ *  Function prototypes, data, and constants for batching tiny multiplies across pairs
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Pairs are batched when every dimension of the product is at most this,
+// which covers all of matrix mode 0
+#define PAIRBATCH_MAX_DIM 4
+
+// Most pairs of one shape multiplied together, see PAIR_BATCH
+#define PAIRBATCH_MAX_PAIRS 32
+
+// Elements of one structure-of-arrays operand or result
+#define PAIRBATCH_ELEMS (PAIRBATCH_MAX_DIM * PAIRBATCH_MAX_DIM * PAIRBATCH_MAX_PAIRS)
+
+// Pairs of one (rows, inner, cols) shape waiting to be multiplied
+typedef struct pair_slot {
+  int count;
+  Matrix * left[PAIRBATCH_MAX_PAIRS];
+  Matrix * right[PAIRBATCH_MAX_PAIRS];
+} PairSlot;
+
+// A consumer's pending pairs, one slot per shape
+// size  - pairs collected before a slot is multiplied
+// a b c - structure-of-arrays operands and result of the slot being multiplied
+typedef struct pair_batch {
+  int size;
+  Element a[PAIRBATCH_ELEMS], b[PAIRBATCH_ELEMS];
+  Product c[PAIRBATCH_ELEMS];
+  PairSlot slots[PAIRBATCH_MAX_DIM][PAIRBATCH_MAX_DIM][PAIRBATCH_MAX_DIM];
+} PairBatch;
+
+// pair batch methods
+PairBatch * pairbatch_create(int size);
+int pairbatch_add(PairBatch * pb, Matrix * m1, Matrix * m2, OutputBuffer * out);
+void pairbatch_flush(PairBatch * pb, OutputBuffer * out);
+void pairbatch_destroy(PairBatch * pb);
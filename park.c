@@ -0,0 +1,166 @@
+/*
+ *  park module
+ *  Adaptive spin, then yield, then futex park
+ *
+ *  Most waits on the buffer end microseconds after they start, well
+ *  before a trip through the kernel would.  A waiting thread therefore
+ *  first spins on its condition with pause, then yields a few times, and
+ *  only then parks on a futex.  How long it spins is set per lot from the
+ *  waits seen so far: about twice the typical wait when that is shorter
+ *  than a sleep and wakeup, the minimum otherwise.  On a single CPU the
+ *  thread being waited for cannot run while we spin, so we never do.
+ *
+ *  A waker only makes a system call when some thread is actually parked,
+ *  and then wakes only as many as it has work for.
+ *
+ *  A lot in shared memory may have waiters in several processes.  One
+ *  that dies while parked costs later wakers a system call, nothing more.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#include "park.h"
+
+static pthread_once_t calibrate_once = PTHREAD_ONCE_INIT;
+static long relax_ns = 1; // measured cost of one park_relax()
+static int spin_cap = PARK_SPIN_MAX; // 0 on a single CPU
+
+// Hint to the CPU that we are busy waiting
+static inline void park_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+static long park_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// Time the pause instruction, its cost differs a lot between CPUs
+static void park_calibrate()
+{
+  long start = park_now();
+  for (int i = 0; i < 4096; i++)
+    park_relax();
+  relax_ns = (park_now() - start) / 4096;
+  if (relax_ns < 1)
+    relax_ns = 1;
+  if (sysconf(_SC_NPROCESSORS_ONLN) <= 1)
+    spin_cap = 0;
+}
+
+static void park_sleep(ParkLot * l, unsigned int seen)
+{
+#if defined(__linux__)
+  syscall(SYS_futex, (unsigned int *) &l->seq, l->shared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+#else
+  if (atomic_load(&l->seq) == seen)
+    sched_yield();
+#endif
+}
+
+static void park_wakeup(ParkLot * l, int n)
+{
+#if defined(__linux__)
+  syscall(SYS_futex, (unsigned int *) &l->seq, l->shared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+#endif
+}
+
+// Fold a wait of ns into the lot's average and pick the next spin budget
+// Racing updates from several waiters may lose one sample, which is harmless
+static void park_observe(ParkLot * l, long ns)
+{
+  long avg = atomic_load_explicit(&l->wait_ns, memory_order_relaxed);
+  avg += (ns - avg) / 8;
+  atomic_store_explicit(&l->wait_ns, avg, memory_order_relaxed);
+  long spin = avg < PARK_SPIN_MAX_NS ? 2 * avg / relax_ns : 0;
+  if (spin < PARK_SPIN_MIN)
+    spin = PARK_SPIN_MIN;
+  if (spin > spin_cap)
+    spin = spin_cap;
+  atomic_store_explicit(&l->spin, (int) spin, memory_order_relaxed);
+}
+
+void park_init(ParkLot * l)
+{
+  pthread_once(&calibrate_once, park_calibrate);
+  atomic_init(&l->seq, 0);
+  atomic_init(&l->waiters, 0);
+  atomic_init(&l->spin, PARK_SPIN_MIN < spin_cap ? PARK_SPIN_MIN : spin_cap);
+  atomic_init(&l->wait_ns, 0);
+  l->shared = 0;
+}
+
+// Set up a lot in memory shared between processes, before any of them uses it
+void park_init_shared(ParkLot * l)
+{
+  park_init(l);
+  l->shared = 1;
+}
+
+// Wait until ready(arg) holds, the caller must hold no lock ready() needs
+// Returns PARK_SPUN, PARK_YIELDED or PARK_PARKED, how far the wait got
+int park_wait(ParkLot * l, int (*ready)(void *), void * arg)
+{
+  int budget = atomic_load_explicit(&l->spin, memory_order_relaxed);
+  for (int i = 0; i < budget; i++) {
+    if (ready(arg)) {
+      park_observe(l, i * relax_ns);
+      return PARK_SPUN;
+    }
+    park_relax();
+  }
+
+  long start = park_now();
+  int phase = PARK_YIELDED;
+  for (int i = 0; !ready(arg); i++) {
+    if (i < PARK_YIELDS) {
+      sched_yield();
+      continue;
+    }
+    // the waiter count is published before the condition is rechecked so a
+    // waker that changes it and then reads the count cannot miss us, and
+    // seq is read first so a wake in between makes the futex return at once
+    unsigned int seen = atomic_load(&l->seq);
+    atomic_fetch_add(&l->waiters, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!ready(arg)) {
+      park_sleep(l, seen);
+      phase = PARK_PARKED;
+    }
+    atomic_fetch_sub(&l->waiters, 1);
+  }
+  park_observe(l, budget * relax_ns + park_now() - start);
+  return phase;
+}
+
+// Wake up to n parked threads, INT_MAX for all, after changing what they wait for
+void park_wake(ParkLot * l, int n)
+{
+  if (n <= 0)
+    return;
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&l->waiters, memory_order_relaxed) == 0)
+    return; // nobody asleep, no system call
+  atomic_fetch_add(&l->seq, 1);
+  park_wakeup(l, n);
+}
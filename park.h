@@ -0,0 +1,47 @@
+/*
+ *  park header
+ *  Function prototypes, data, and constants for adaptive spin-then-park waiting
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+// Spin budget bounds, in pause instructions
+#define PARK_SPIN_MIN 16
+#define PARK_SPIN_MAX 8192
+
+// Waits that typically take longer than this are cheaper to sleep through
+// than to spin through, the budget drops to PARK_SPIN_MIN
+#define PARK_SPIN_MAX_NS 20000
+
+// sched_yield() calls between spinning and parking
+#define PARK_YIELDS 4
+
+// How a wait ended, see park_wait()
+#define PARK_SPUN 0
+#define PARK_YIELDED 1
+#define PARK_PARKED 2
+
+// Threads waiting for one condition
+// seq     - futex word, bumped by every wake so a parking thread cannot miss one
+// waiters - threads parked or about to park
+// spin    - current spin budget
+// wait_ns - moving average of how long waits on this lot took
+// shared  - the lot lives in memory shared between processes
+typedef struct park_lot {
+  _Atomic unsigned int seq __attribute__((aligned(CACHE_LINE_SIZE)));
+  _Atomic int waiters;
+  _Atomic int spin;
+  _Atomic long wait_ns;
+  int shared;
+} ParkLot;
+
+// park methods
+void park_init(ParkLot * l);
+void park_init_shared(ParkLot * l);
+int park_wait(ParkLot * l, int (*ready)(void *), void * arg);
+void park_wake(ParkLot * l, int n);
@@ -34,132 +34,762 @@
 #include <pthread.h>
 #include <assert.h>
 #include <time.h>
+#include <string.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "element.h"
 #include "matrix.h"
 #include "counter.h"
-#include "prodcons.h"
+#include "ring.h"
+#include "steal.h"
+#include "match.h"
+#include "lanes.h"
+#include "output.h"
+#include "pairbatch.h"
+#include "bench.h"
+#include "instrument.h"
+#include "adapt.h"
+#include "affinity.h"
+#include "mulpool.h"
+#include "input.h"
+#include "park.h"
+#include "latency.h"
+#include "chain.h"
+#include "prodcache.h"
 #include "pcmatrix.h"
+#include "prodcons.h"
+#include "stages.h"
+#include "procs.h"
 
-int main (int argc, char * argv[])
+// Run the producers and consumers once with the current settings and
+// aggregate every worker's statistics into totals
+// Results go to output_fd unless RESULT_OUTPUT is quiet
+void run_pipeline(int nprod, int ncons, int output_fd, RunTotals * totals)
 {
-  // Process command line arguments
-  int numw = NUMWORK;
-  if (argc==1)
-  {
-    BOUNDED_BUFFER_SIZE=MAX;
-    NUMBER_OF_MATRICES=LOOPS;
-    MATRIX_MODE=DEFAULT_MATRIX_MODE;
-    printf("USING DEFAULTS: worker_threads=%d bounded_buffer_size=%d matricies=%d matrix_mode=%d\n",numw,BOUNDED_BUFFER_SIZE,NUMBER_OF_MATRICES,MATRIX_MODE);
+  latency_reset();
+  chain_reset();
+  prodcache_reset();
+  if (STAGED) {
+    stages_run(output_fd, totals); // worker counts come from --stages instead
+    return;
   }
-  else
-  {
-    if (argc==2)
-    {
-      numw=atoi(argv[1]);
-      BOUNDED_BUFFER_SIZE=MAX;
-      NUMBER_OF_MATRICES=LOOPS;
-      MATRIX_MODE=DEFAULT_MATRIX_MODE;
-    }
-    if (argc==3)
-    {
-      numw=atoi(argv[1]);
-      BOUNDED_BUFFER_SIZE=atoi(argv[2]);
-      NUMBER_OF_MATRICES=LOOPS;
-      MATRIX_MODE=DEFAULT_MATRIX_MODE;
-    }
-    if (argc==4)
-    {
-      numw=atoi(argv[1]);
-      BOUNDED_BUFFER_SIZE=atoi(argv[2]);
-      NUMBER_OF_MATRICES=atoi(argv[3]);
-      MATRIX_MODE=DEFAULT_MATRIX_MODE;
-    }
-    if (argc==5)
-    {
-      numw=atoi(argv[1]);
-      BOUNDED_BUFFER_SIZE=atoi(argv[2]);
-      NUMBER_OF_MATRICES=atoi(argv[3]);
-      MATRIX_MODE=atoi(argv[4]);
-    }
-    printf("USING: worker_threads=%d bounded_buffer_size=%d matricies=%d matrix_mode=%d\n",numw,BOUNDED_BUFFER_SIZE,NUMBER_OF_MATRICES,MATRIX_MODE);
+  if (PROCESSES) {
+    procs_run(nprod, ncons, output_fd, totals); // same workers, one process each
+    return;
   }
-
-  time_t t;
-  // Seed the random number generator with the system time
-  srand((unsigned) time(&t));
-
-  printf("Producing %d matrices in mode %d.\n",NUMBER_OF_MATRICES,MATRIX_MODE);
-  printf("Using a shared buffer of size=%d\n", BOUNDED_BUFFER_SIZE);
-  printf("With %d producer and consumer thread(s).\n",numw);
-  printf("\n");
-
-  
-  bigmatrix = (Matrix **) malloc(sizeof(Matrix *) * BOUNDED_BUFFER_SIZE); // allocate bounded buffer matrix array
+  reset_buffer(); // start from an empty buffer
+  if (MATRIX_INPUT)
+    input_rewind(); // every run replays the input from the start
+  instr_reset();
+  if (BUFFER_MODE == BUFFER_MODE_RING)
+    bigring = ring_create(BOUNDED_BUFFER_SIZE); // allocate lock-free ring
+  else if (BUFFER_MODE == BUFFER_MODE_MATCH)
+    bigindex = match_create(BOUNDED_BUFFER_SIZE); // allocate shape-indexed buffer
+  else if (BUFFER_MODE == BUFFER_MODE_STEAL)
+    bigsteal = steal_create(nprod, BOUNDED_BUFFER_SIZE); // one queue per producer, sharing the buffer size
+  else if (BUFFER_MODE == BUFFER_MODE_LANES)
+    biglanes = lanes_create(BOUNDED_BUFFER_SIZE, LANE_THRESHOLD); // small and large lanes, sharing the buffer size
+  else
+    bigmatrix = (Matrix **) malloc(sizeof(Matrix *) * BOUNDED_BUFFER_SIZE); // allocate bounded buffer matrix array
 
   prodc = (counter_t *) malloc(sizeof(counter_t)); // allocate counters for produced matrices
   conc = (counter_t *) malloc(sizeof(counter_t)); // allocate counters for consumed matrices
   init_cnt(prodc); // initialize counters for produced matrices
   init_cnt(conc); // initialize counters
+  discardc = (sharded_counter_t *) malloc(sizeof(sharded_counter_t)); // allocate counter for discarded matrices
+  init_shcnt(discardc, ncons); // one shard per consumer
+
+  // Start the writer thread that consumers hand their formatted results to
+  fflush(stdout); // everything printed so far must come out before the results
+  if (RESULT_OUTPUT != RESULT_QUIET)
+    output_start(output_fd, ncons);
+
+  // Decide where each worker will be pinned, if anywhere
+  affinity_plan(nprod, ncons);
+
+  // Start the helpers consumers share large multiplies with
+  mulpool_start(MUL_THREADS, nprod + ncons);
+
+  // Start the adaptive scaling controller, if enabled
+  adapt_start(nprod, ncons);
 
   // Allocate arrays for multiple producers and consumers
-  pthread_t *producers = (pthread_t *) malloc(sizeof(pthread_t) * numw);
-  pthread_t *consumers = (pthread_t *) malloc(sizeof(pthread_t) * numw);
+  pthread_t *producers = (pthread_t *) malloc(sizeof(pthread_t) * nprod);
+  pthread_t *consumers = (pthread_t *) malloc(sizeof(pthread_t) * ncons);
 
   // Allocate arrays for ProdConsStats structs
-  ProdConsStats **prod_stats = (ProdConsStats **) malloc(sizeof(ProdConsStats *) * numw);
-  ProdConsStats **cons_stats = (ProdConsStats **) malloc(sizeof(ProdConsStats *) * numw);
+  ProdConsStats **prod_stats = (ProdConsStats **) malloc(sizeof(ProdConsStats *) * nprod);
+  ProdConsStats **cons_stats = (ProdConsStats **) malloc(sizeof(ProdConsStats *) * ncons);
 
   // Calculate work distribution for producers
-  int matrices_per_producer = NUMBER_OF_MATRICES / numw; // base number of matrices per producer
-  int remainder = NUMBER_OF_MATRICES % numw; // remainder matrices to distribute
+  int matrices_per_producer = NUMBER_OF_MATRICES / nprod; // base number of matrices per producer
+  int remainder = NUMBER_OF_MATRICES % nprod; // remainder matrices to distribute
 
   // Create producer threads with specific work counts
-  for (int i = 0; i < numw; i++) {
-    int *work = (int *) malloc(sizeof(int)); // allocate memory for work count
-    *work = matrices_per_producer + (i < remainder ? 1 : 0); // distribute remainder among producers
+  for (int i = 0; i < nprod; i++) {
+    ProducerArgs *work = (ProducerArgs *) malloc(sizeof(ProducerArgs)); // allocate memory for producer arguments
+    work->id = i; // producer index, selects its random stream
+    work->work = matrices_per_producer + (i < remainder ? 1 : 0); // distribute remainder among producers
     pthread_create(&producers[i], NULL, prod_worker, work); // create producer thread
   }
 
   // Create consumer threads
-  for (int i = 0; i < numw; i++) {
-    pthread_create(&consumers[i], NULL, cons_worker, NULL); // create consumer thread
+  for (int i = 0; i < ncons; i++) {
+    int *id = (int *) malloc(sizeof(int)); // allocate memory for consumer index
+    *id = i;
+    pthread_create(&consumers[i], NULL, cons_worker, id); // create consumer thread
   }
 
   // These are used to aggregate total numbers for main thread output
-  int prs = 0; // total #matrices produced
-  int cos = 0; // total #matrices consumed
-  int prodtot = 0; // total sum of elements for matrices produced
-  int constot = 0; // total sum of elements for matrices consumed
-  int consmul = 0; // total # multiplications
+  long prs = 0; // total #matrices produced
+  long cos = 0; // total #matrices consumed
+  long prodtot = 0; // total sum of elements for matrices produced
+  long constot = 0; // total sum of elements for matrices consumed
+  long consmul = 0; // total # multiplications
 
   // Join producer threads and aggregate their stats
-  for (int i = 0; i < numw; i++) {
+  for (int i = 0; i < nprod; i++) {
     pthread_join(producers[i], (void**) &prod_stats[i]);
     prs += prod_stats[i]->matrixtotal;
     prodtot += prod_stats[i]->sumtotal;
   }
 
   // Join consumer threads and aggregate their stats
-  for (int i = 0; i < numw; i++) {
+  for (int i = 0; i < ncons; i++) {
     pthread_join(consumers[i], (void**) &cons_stats[i]);
     cos += cons_stats[i]->matrixtotal;
     constot += cons_stats[i]->sumtotal;
     consmul += cons_stats[i]->multtotal;
   }
 
-  printf("Sum of Matrix elements --> Produced=%d = Consumed=%d\n",prodtot,constot);
-  printf("Matrices produced=%d consumed=%d multiplied=%d\n",prs,cos,consmul);
+  // Write the remaining results
+  output_stop();
+  mulpool_stop();
+  adapt_stop(&totals->adapt);
+
+  totals->produced = prs;
+  totals->consumed = cos;
+  totals->prodsum = prodtot;
+  totals->conssum = constot;
+  totals->multiplied = consmul;
+  totals->discarded = get_shcnt(discardc);
+  totals->routed_large = BUFFER_MODE == BUFFER_MODE_LANES ? biglanes->routed[LANE_LARGE] : 0;
+  totals->spilled = BUFFER_MODE == BUFFER_MODE_LANES ? biglanes->spilled : 0;
+  totals->failed = 0;
 
   // Clean up allocated memory
-  for (int i = 0; i < numw; i++) {
+  for (int i = 0; i < nprod; i++)
     free(prod_stats[i]);
+  for (int i = 0; i < ncons; i++)
     free(cons_stats[i]);
-  }
   free(producers);
   free(consumers);
   free(prod_stats);
   free(cons_stats);
-  free(bigmatrix);
+  if (BUFFER_MODE == BUFFER_MODE_RING)
+    ring_destroy(bigring);
+  else if (BUFFER_MODE == BUFFER_MODE_MATCH)
+    match_destroy(bigindex);
+  else if (BUFFER_MODE == BUFFER_MODE_STEAL)
+    steal_destroy(bigsteal);
+  else if (BUFFER_MODE == BUFFER_MODE_LANES)
+    lanes_destroy(biglanes);
+  else
+    free(bigmatrix);
   free(prodc);
   free(conc);
+  free_shcnt(discardc);
+  free(discardc);
+}
+
+// Parse a --buffer name into a BUFFER_MODE value, -1 if unknown
+int parse_buffer_mode(const char * name)
+{
+  if (strcmp(name, "condvar") == 0)
+    return BUFFER_MODE_CONDVAR;
+  if (strcmp(name, "ring") == 0)
+    return BUFFER_MODE_RING;
+  if (strcmp(name, "match") == 0)
+    return BUFFER_MODE_MATCH;
+  if (strcmp(name, "steal") == 0)
+    return BUFFER_MODE_STEAL;
+  if (strcmp(name, "lanes") == 0)
+    return BUFFER_MODE_LANES;
+  return -1;
+}
+
+// Print command line usage
+void usage(char * prog)
+{
+  fprintf(stderr, "usage: %s [options] [worker_threads [bounded_buffer_size [matricies [matrix_mode]]]]\n", prog);
+  fprintf(stderr, "  --buffer=condvar|ring|match|steal|lanes\n");
+  fprintf(stderr, "                               bounded buffer implementation (default condvar), steal splits\n");
+  fprintf(stderr, "                               the buffer between producers and needs a slot for each\n");
+  fprintf(stderr, "  --lane-threshold=N           lanes: multiply-adds from which a matrix is large (default %d)\n", DEFAULT_LANE_THRESHOLD);
+  fprintf(stderr, "  --lane-share=P               lanes: percent of consumers serving the large lane (default %d)\n", DEFAULT_LANE_SHARE);
+  fprintf(stderr, "  --producers=N                producer threads (default worker_threads)\n");
+  fprintf(stderr, "  --consumers=N                consumer threads (default worker_threads)\n");
+  fprintf(stderr, "  --mul-threads=N              helper threads for large multiplies, 0 disables (default: idle CPUs)\n");
+  fprintf(stderr, "  --mul-threshold=N            multiply-adds before a product is split (default %d)\n", DEFAULT_MUL_THRESHOLD);
+  fprintf(stderr, "  --pair-batch=N               tiny pairs of one shape multiplied together, 0-%d, 0 disables (default %d)\n", PAIRBATCH_MAX_PAIRS, DEFAULT_PAIR_BATCH);
+  fprintf(stderr, "  --affinity=none|compact|scatter\n");
+  fprintf(stderr, "                               pin producer/consumer pairs to CPUs on one NUMA node (default none)\n");
+  fprintf(stderr, "  --producer-cpus=LIST         pin producers to CPUs in LIST, e.g. 0-3,8 (overrides --affinity)\n");
+  fprintf(stderr, "  --consumer-cpus=LIST         pin consumers to CPUs in LIST\n");
+  fprintf(stderr, "  --stages=G,C,P,M,O           staged pipeline, workers for generate, checksum, pair, multiply\n");
+  fprintf(stderr, "                               and output, each stage fed by its own bounded queue\n");
+  fprintf(stderr, "  --processes                  run every producer and consumer as a process, sharing the\n");
+  fprintf(stderr, "                               buffer and matrices through POSIX shared memory\n");
+  fprintf(stderr, "  --adaptive                   park and unpark workers at runtime to keep the pipeline balanced\n");
+  fprintf(stderr, "  --wait=block|adaptive        condvar buffer waits block at once, or spin, yield, then park (default block)\n");
+  fprintf(stderr, "  --batch=N                    matrices moved per buffer operation, 1-%d (default %d)\n", MAX_BATCH, DEFAULT_BATCH_SIZE);
+  fprintf(stderr, "  --chain=N                    multiply chains of up to N compatible matrices, 2-%d, in the\n", CHAIN_MAX);
+  fprintf(stderr, "                               order with the fewest multiply-adds (default: pairs)\n");
+  fprintf(stderr, "  --product-cache=MIB          look up products of operands seen before in a cache of up to\n");
+  fprintf(stderr, "                               MIB MiB, 0 disables (default 0)\n");
+  fprintf(stderr, "  --latency                    report percentiles of per-matrix buffer and end-to-end latency\n");
+  fprintf(stderr, "  --seed=N                     seed for reproducible runs, producer i uses stream i (default clock)\n");
+  fprintf(stderr, "  --output=text|quiet|binary|products\n");
+  fprintf(stderr, "                               result format, quiet skips formatting entirely, products writes\n");
+  fprintf(stderr, "                               only the products as binary records (default text)\n");
+  fprintf(stderr, "  --input=FILE                 replay binary matrix records from FILE instead of generating\n");
+  fprintf(stderr, "                               matrices, may be repeated (matricies defaults to all records)\n");
+  fprintf(stderr, "  --output-file=PATH           write results to PATH instead of stdout\n");
+  fprintf(stderr, "  --pool=on|off                recycle freed matrices through a free-list pool (default on)\n");
+  fprintf(stderr, "  --bench                      benchmark mode, sweep the lists below and report statistics\n");
+  fprintf(stderr, "  --bench-threads=N,...        worker thread counts to sweep (default 1,2,4,8)\n");
+  fprintf(stderr, "  --bench-buffers=N,...        bounded buffer sizes to sweep (default bounded_buffer_size)\n");
+  fprintf(stderr, "  --bench-modes=N,...          matrix modes to sweep (default matrix_mode)\n");
+  fprintf(stderr, "  --bench-impls=NAME,...       buffer implementations to sweep (default --buffer)\n");
+  fprintf(stderr, "  --bench-trials=N             measured runs per combination (default %d)\n", BENCH_DEFAULT_TRIALS);
+  fprintf(stderr, "  --bench-warmup=N             discarded runs per combination (default %d)\n", BENCH_DEFAULT_WARMUP);
+  fprintf(stderr, "  --bench-format=json|csv      report format (default json)\n");
+}
+
+int main (int argc, char * argv[])
+{
+  // Process command line options
+  static struct option long_options[] = {
+    {"buffer", required_argument, 0, 'b'},
+    {"pool", required_argument, 0, 'p'},
+    {"batch", required_argument, 0, 'n'},
+    {"seed", required_argument, 0, 's'},
+    {"producers", required_argument, 0, 'P'},
+    {"consumers", required_argument, 0, 'C'},
+    {"adaptive", no_argument, 0, 'A'},
+    {"affinity", required_argument, 0, 'a'},
+    {"mul-threads", required_argument, 0, 'm'},
+    {"mul-threshold", required_argument, 0, 't'},
+    {"pair-batch", required_argument, 0, 'g'},
+    {"wait", required_argument, 0, 'w'},
+    {"stages", required_argument, 0, 'k'},
+    {"processes", no_argument, 0, 'x'},
+    {"latency", no_argument, 0, 'e'},
+    {"chain", required_argument, 0, 'h'},
+    {"product-cache", required_argument, 0, 'u'},
+    {"lane-threshold", required_argument, 0, 'L'},
+    {"lane-share", required_argument, 0, 'l'},
+    {"producer-cpus", required_argument, 0, 'c'},
+    {"consumer-cpus", required_argument, 0, 'd'},
+    {"output", required_argument, 0, 'o'},
+    {"output-file", required_argument, 0, 'f'},
+    {"input", required_argument, 0, 'i'},
+    {"bench", no_argument, 0, 'B'},
+    {"bench-threads", required_argument, 0, 'T'},
+    {"bench-buffers", required_argument, 0, 'S'},
+    {"bench-modes", required_argument, 0, 'M'},
+    {"bench-impls", required_argument, 0, 'I'},
+    {"bench-trials", required_argument, 0, 'R'},
+    {"bench-warmup", required_argument, 0, 'W'},
+    {"bench-format", required_argument, 0, 'F'},
+    {0, 0, 0, 0}
+  };
+  BUFFER_MODE=DEFAULT_BUFFER_MODE;
+  MATRIX_POOL=DEFAULT_MATRIX_POOL;
+  BATCH_SIZE=DEFAULT_BATCH_SIZE;
+  RESULT_OUTPUT=DEFAULT_RESULT_OUTPUT;
+  ADAPTIVE=DEFAULT_ADAPTIVE;
+  AFFINITY=DEFAULT_AFFINITY;
+  MUL_THREADS=DEFAULT_MUL_THREADS;
+  MUL_THRESHOLD=DEFAULT_MUL_THRESHOLD;
+  PAIR_BATCH=DEFAULT_PAIR_BATCH;
+  WAIT_MODE=DEFAULT_WAIT_MODE;
+  LANE_THRESHOLD=DEFAULT_LANE_THRESHOLD;
+  LANE_SHARE=DEFAULT_LANE_SHARE;
+  int nprod = 0; // 0 - same as worker_threads
+  int ncons = 0;
+  int seed_given = 0;
+  char * output_file = NULL;
+  int output_given = 0;
+  BenchConfig bench;
+  bench_init(&bench);
+  int opt;
+  while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1)
+  {
+    switch (opt)
+    {
+      case 'b':
+        BUFFER_MODE=parse_buffer_mode(optarg);
+        if (BUFFER_MODE < 0)
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'p':
+        if (strcmp(optarg, "on") == 0)
+          MATRIX_POOL=1;
+        else if (strcmp(optarg, "off") == 0)
+          MATRIX_POOL=0;
+        else
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'n':
+        BATCH_SIZE=atoi(optarg);
+        if (BATCH_SIZE < 1 || BATCH_SIZE > MAX_BATCH)
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 's':
+        RANDOM_SEED=strtoul(optarg, NULL, 0);
+        seed_given=1;
+        break;
+      case 'P':
+        nprod=atoi(optarg);
+        if (nprod < 1)
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'C':
+        ncons=atoi(optarg);
+        if (ncons < 1)
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'A':
+        ADAPTIVE=1;
+        break;
+      case 'm':
+        MUL_THREADS=atoi(optarg);
+        if (MUL_THREADS < 0)
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 't':
+        MUL_THRESHOLD=atol(optarg);
+        if (MUL_THRESHOLD < 1)
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'L':
+        LANE_THRESHOLD=atol(optarg);
+        if (LANE_THRESHOLD < 1)
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'l':
+        LANE_SHARE=atoi(optarg);
+        if (LANE_SHARE < 1 || LANE_SHARE > 99)
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'k':
+        if (stages_parse(optarg) < 0)
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        STAGED=1;
+        break;
+      case 'x':
+        PROCESSES=1;
+        break;
+      case 'e':
+        LATENCY=1;
+        break;
+      case 'h':
+        CHAIN_LENGTH=atoi(optarg);
+        if (CHAIN_LENGTH < 2 || CHAIN_LENGTH > CHAIN_MAX)
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'u':
+        PRODUCT_CACHE=atoi(optarg);
+        if (PRODUCT_CACHE < 0)
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'w':
+        if (strcmp(optarg, "block") == 0)
+          WAIT_MODE=WAIT_BLOCK;
+        else if (strcmp(optarg, "adaptive") == 0)
+          WAIT_MODE=WAIT_ADAPTIVE;
+        else
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'g':
+        PAIR_BATCH=atoi(optarg);
+        if (PAIR_BATCH < 0 || PAIR_BATCH > PAIRBATCH_MAX_PAIRS)
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'a':
+        if (AFFINITY == AFFINITY_LIST)
+          break; // explicit CPU lists win
+        if (strcmp(optarg, "none") == 0)
+          AFFINITY=AFFINITY_NONE;
+        else if (strcmp(optarg, "compact") == 0)
+          AFFINITY=AFFINITY_COMPACT;
+        else if (strcmp(optarg, "scatter") == 0)
+          AFFINITY=AFFINITY_SCATTER;
+        else
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'c':
+      case 'd':
+        if (affinity_set_cpus(opt == 'c' ? AFFINITY_PRODUCER : AFFINITY_CONSUMER, optarg) < 0)
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        AFFINITY=AFFINITY_LIST;
+        break;
+      case 'o':
+        output_given=1;
+        if (strcmp(optarg, "text") == 0)
+          RESULT_OUTPUT=RESULT_TEXT;
+        else if (strcmp(optarg, "quiet") == 0)
+          RESULT_OUTPUT=RESULT_QUIET;
+        else if (strcmp(optarg, "binary") == 0)
+          RESULT_OUTPUT=RESULT_BINARY;
+        else if (strcmp(optarg, "products") == 0)
+          RESULT_OUTPUT=RESULT_PRODUCTS;
+        else
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'f':
+        output_file=optarg;
+        break;
+      case 'i':
+        if (input_open(optarg) < 0)
+          return 1;
+        MATRIX_INPUT=1;
+        break;
+      case 'B':
+        bench.enabled=1;
+        break;
+      case 'T':
+        bench.nthreads=bench_parse_list(optarg, bench.threads, BENCH_MAX_VALUES, bench_parse_int);
+        if (bench.nthreads <= 0)
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'S':
+        bench.nbuffers=bench_parse_list(optarg, bench.buffers, BENCH_MAX_VALUES, bench_parse_int);
+        if (bench.nbuffers <= 0)
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'M':
+        bench.nmodes=bench_parse_list(optarg, bench.modes, BENCH_MAX_VALUES, bench_parse_int);
+        if (bench.nmodes <= 0)
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'I':
+        bench.nimpls=bench_parse_list(optarg, bench.impls, BENCH_MAX_VALUES, parse_buffer_mode);
+        if (bench.nimpls <= 0)
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'R':
+        bench.trials=atoi(optarg);
+        if (bench.trials < 1)
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'W':
+        bench.warmup=atoi(optarg);
+        if (bench.warmup < 0)
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'F':
+        if (strcmp(optarg, "json") == 0)
+          bench.format=BENCH_JSON;
+        else if (strcmp(optarg, "csv") == 0)
+          bench.format=BENCH_CSV;
+        else
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  // Process positional arguments
+  int nargs = argc - optind;
+  char ** args = argv + optind;
+  int numw = NUMWORK;
+  if (nargs==0)
+  {
+    BOUNDED_BUFFER_SIZE=MAX;
+    NUMBER_OF_MATRICES=LOOPS;
+    MATRIX_MODE=DEFAULT_MATRIX_MODE;
+    if (!bench.enabled)
+      printf("USING DEFAULTS: worker_threads=%d bounded_buffer_size=%d matricies=%d matrix_mode=%d\n",numw,BOUNDED_BUFFER_SIZE,NUMBER_OF_MATRICES,MATRIX_MODE);
+  }
+  else
+  {
+    if (nargs==1)
+    {
+      numw=atoi(args[0]);
+      BOUNDED_BUFFER_SIZE=MAX;
+      NUMBER_OF_MATRICES=LOOPS;
+      MATRIX_MODE=DEFAULT_MATRIX_MODE;
+    }
+    if (nargs==2)
+    {
+      numw=atoi(args[0]);
+      BOUNDED_BUFFER_SIZE=atoi(args[1]);
+      NUMBER_OF_MATRICES=LOOPS;
+      MATRIX_MODE=DEFAULT_MATRIX_MODE;
+    }
+    if (nargs==3)
+    {
+      numw=atoi(args[0]);
+      BOUNDED_BUFFER_SIZE=atoi(args[1]);
+      NUMBER_OF_MATRICES=atoi(args[2]);
+      MATRIX_MODE=DEFAULT_MATRIX_MODE;
+    }
+    if (nargs==4)
+    {
+      numw=atoi(args[0]);
+      BOUNDED_BUFFER_SIZE=atoi(args[1]);
+      NUMBER_OF_MATRICES=atoi(args[2]);
+      MATRIX_MODE=atoi(args[3]);
+    }
+    if (!bench.enabled)
+      printf("USING: worker_threads=%d bounded_buffer_size=%d matricies=%d matrix_mode=%d\n",numw,BOUNDED_BUFFER_SIZE,NUMBER_OF_MATRICES,MATRIX_MODE);
+  }
+
+  // Replayed input decides how many matrices there are, matricies can only ask for fewer
+  if (MATRIX_INPUT && (nargs < 3 || NUMBER_OF_MATRICES > input_count()))
+    NUMBER_OF_MATRICES = input_count();
+
+  // Process mode has a buffer of its own and runs every worker for the whole run
+  if (PROCESSES && (BUFFER_MODE != DEFAULT_BUFFER_MODE || STAGED || ADAPTIVE || bench.enabled))
+  {
+    fprintf(stderr, "%s: --processes cannot be combined with --buffer, --stages, --adaptive or --bench\n", argv[0]);
+    return 1;
+  }
+
+  // Stage workers multiply pairs, consumers are the only ones who collect chains
+  if (CHAIN_LENGTH && STAGED)
+  {
+    fprintf(stderr, "%s: --chain cannot be combined with --stages\n", argv[0]);
+    return 1;
+  }
+
+  // Producer and consumer counts default to worker_threads
+  if (nprod == 0)
+    nprod = numw;
+  if (ncons == 0)
+    ncons = numw;
+
+  // Find the CPUs and NUMA nodes workers can be pinned to
+  if (AFFINITY != AFFINITY_NONE && affinity_init() == 0)
+  {
+    fprintf(stderr, "%s: cannot determine the available CPUs, not pinning workers\n", argv[0]);
+    AFFINITY = AFFINITY_NONE;
+  }
+
+  // Seed the random number generators with the system time unless a seed was given
+  if (!seed_given)
+    RANDOM_SEED = (unsigned long) time(NULL);
+
+  if (bench.enabled)
+  {
+    // Benchmarks use a fixed seed and skip result output unless asked otherwise
+    int default_threads[] = { 1, 2, 4, 8 };
+    if (!seed_given)
+      RANDOM_SEED = BENCH_DEFAULT_SEED;
+    if (!output_given)
+      RESULT_OUTPUT = RESULT_QUIET;
+    if (bench.nthreads == 0)
+    {
+      bench.nthreads = sizeof(default_threads) / sizeof(default_threads[0]);
+      memcpy(bench.threads, default_threads, sizeof(default_threads));
+    }
+    if (bench.nbuffers == 0)
+      bench.buffers[bench.nbuffers++] = BOUNDED_BUFFER_SIZE;
+    if (bench.nmodes == 0)
+      bench.modes[bench.nmodes++] = MATRIX_MODE;
+    if (bench.nimpls == 0)
+      bench.impls[bench.nimpls++] = BUFFER_MODE;
+  }
+
+  // Every producer's steal queue needs a slot of the buffer
+  for (int i = 0; i < (bench.enabled ? bench.nimpls : 1); i++)
+    for (int b = 0; b < (bench.enabled ? bench.nbuffers : 1); b++)
+      for (int t = 0; t < (bench.enabled ? bench.nthreads : 1); t++)
+      {
+        int impl = bench.enabled ? bench.impls[i] : BUFFER_MODE;
+        int size = bench.enabled ? bench.buffers[b] : BOUNDED_BUFFER_SIZE;
+        int producers = bench.enabled ? bench.threads[t] : nprod;
+        if (impl == BUFFER_MODE_STEAL && size < producers)
+        {
+          fprintf(stderr, "%s: --buffer=steal needs a bounded_buffer_size of at least one slot per producer (%d < %d)\n", argv[0], size, producers);
+          return 1;
+        }
+      }
+
+  // Open the file results are written to
+  int output_fd = STDOUT_FILENO;
+  if (output_file != NULL)
+  {
+    output_fd = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (output_fd < 0)
+    {
+      perror(output_file);
+      return 1;
+    }
+  }
+
+  if (bench.enabled)
+  {
+    int rc = bench_run(&bench, output_fd);
+    if (output_fd != STDOUT_FILENO)
+      close(output_fd);
+    prodcache_destroy();
+    MatrixPoolDestroy();
+    input_close();
+    return rc;
+  }
+
+  if (MATRIX_INPUT)
+    printf("Replaying %d recorded matrices.\n",NUMBER_OF_MATRICES);
+  else
+    printf("Producing %d matrices in mode %d with seed=%lu.\n",NUMBER_OF_MATRICES,MATRIX_MODE,RANDOM_SEED);
+  const char * buffer_names[] = { "condvar", "lock-free ring", "shape-matching", "work-stealing", "size-routed" };
+  if (STAGED)
+  {
+    printf("Using lock-free ring queues of size=%d between stages\n", BOUNDED_BUFFER_SIZE);
+    stages_describe(stdout);
+  }
+  else if (PROCESSES)
+  {
+    printf("Using a POSIX shared-memory buffer of size=%d\n", BOUNDED_BUFFER_SIZE);
+    if (nprod == ncons)
+      printf("With %d producer and consumer process(es).\n",nprod);
+    else
+      printf("With %d producer and %d consumer process(es).\n",nprod,ncons);
+  }
+  else
+  {
+    printf("Using a shared %s buffer of size=%d\n", buffer_names[BUFFER_MODE], BOUNDED_BUFFER_SIZE);
+    if (nprod == ncons)
+      printf("With %d producer and consumer thread(s).\n",nprod);
+    else
+      printf("With %d producer and %d consumer thread(s).\n",nprod,ncons);
+  }
+  if (AFFINITY != AFFINITY_NONE)
+  {
+    const char * affinity_names[] = { "none", "compact", "scatter", "explicit CPU lists" };
+    printf("Pinning workers by %s over %d CPU(s) on %d NUMA node(s).\n",affinity_names[AFFINITY],affinity_cpus(),affinity_nodes());
+  }
+  if (ADAPTIVE)
+    printf("Scaling active producers and consumers adaptively.\n");
+  if (BATCH_SIZE > 1)
+    printf("Moving up to %d matrices per buffer operation.\n",BATCH_SIZE);
+  if (MATRIX_ELEMENT != ELEMENT_INT32)
+    printf("Storing matrix elements as %s.\n",ELEMENT_NAME);
+  if (CHAIN_LENGTH)
+    printf("Multiplying chains of up to %d matrices in their cheapest order.\n",CHAIN_LENGTH);
+  if (PRODUCT_CACHE)
+    printf("Caching products in up to %d MiB%s.\n",PRODUCT_CACHE,PROCESSES ? " per consumer process" : "");
+  printf("\n");
+
+  RunTotals totals;
+  run_pipeline(nprod, ncons, output_fd, &totals);
+  if (output_fd != STDOUT_FILENO)
+    close(output_fd);
+
+  printf("Sum of Matrix elements --> Produced=%ld = Consumed=%ld\n",totals.prodsum,totals.conssum);
+  printf("Matrices produced=%ld consumed=%ld multiplied=%ld\n",totals.produced,totals.consumed,totals.multiplied);
+  printf("Matrices discarded without a partner=%ld\n",totals.discarded);
+  if (BUFFER_MODE == BUFFER_MODE_LANES && !STAGED)
+    printf("Lanes: %ld matrices routed to the large lane, %ld taken by the other lane's consumers\n",totals.routed_large,totals.spilled);
+  if (CHAIN_LENGTH)
+    chain_report(stdout);
+  if (PRODUCT_CACHE)
+    prodcache_report(stdout);
+  if (LATENCY)
+    latency_report(stdout);
+  if (ADAPTIVE)
+    printf("Adaptive scaling: %d adjustment(s), ended with %d producer(s) and %d consumer(s), averaged %.1f and %.1f\n",
+           totals.adapt.adjustments,totals.adapt.producers,totals.adapt.consumers,
+           totals.adapt.mean_producers,totals.adapt.mean_consumers);
+#if INSTRUMENT
+  instr_report(stdout);
+#endif
+
+  prodcache_destroy();
+  MatrixPoolDestroy();
+  input_close();
+  if (totals.failed > 0)
+  {
+    printf("Run aborted: %d worker process(es) failed, the totals are incomplete\n",totals.failed);
+    return 1;
+  }
   return 0;
 }
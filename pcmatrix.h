@@ -7,6 +7,7 @@
  */
 
 // Number of worker threads - NUMWORK producers, NUMWORK consumers
+// unless --producers / --consumers say otherwise
 #define NUMWORK 3
 
 // Constant for enabling and disabling DEBUG output
@@ -25,3 +26,137 @@ int NUMBER_OF_MATRICES;
 // mode 1-n - Specifies a fixed number of rows and cols with matrix elements of 1
 #define DEFAULT_MATRIX_MODE 0
 int MATRIX_MODE;
+
+// BUFFER MODE FLAG
+// mode 0 - mutex/condition variable bounded buffer
+// mode 1 - lock-free multi-producer/multi-consumer ring
+// mode 2 - mutex/condition variable buffer indexed by shape, consumers take a compatible partner directly
+// mode 3 - one lock-free queue per producer, consumers steal from other queues when their own is empty
+// mode 4 - small and large matrices routed to separate lanes, each served by its own consumers
+#define BUFFER_MODE_CONDVAR 0
+#define BUFFER_MODE_RING 1
+#define BUFFER_MODE_MATCH 2
+#define BUFFER_MODE_STEAL 3
+#define BUFFER_MODE_LANES 4
+#define DEFAULT_BUFFER_MODE BUFFER_MODE_CONDVAR
+int BUFFER_MODE;
+
+// SIZE-ROUTED LANES
+// In lanes mode a matrix whose product would take LANE_THRESHOLD or more
+// multiply-adds goes to the large lane, and LANE_SHARE percent of the
+// consumers (at least one) serve it; the rest serve the small lane
+#define DEFAULT_LANE_THRESHOLD (32 * 32 * 32)
+#define DEFAULT_LANE_SHARE 25
+long LANE_THRESHOLD;
+int LANE_SHARE;
+
+// MATRIX POOL FLAG
+// 0 - AllocMatrix()/FreeMatrix() go straight to the heap
+// 1 - freed matrices are recycled through per-thread and shared free lists
+#define DEFAULT_MATRIX_POOL 1
+int MATRIX_POOL;
+
+// BATCH SIZE
+// Number of matrices producers publish and consumers fetch per buffer operation
+#define MAX_BATCH 256
+#define DEFAULT_BATCH_SIZE 1
+int BATCH_SIZE;
+
+// PARALLEL MULTIPLY
+// Products needing at least MUL_THRESHOLD multiply-adds are split by rows
+// across a pool of MUL_THREADS helper threads, -1 sizes the pool to the
+// CPUs left over by the producers and consumers, 0 disables it; with
+// --processes the consumer processes split the pool between them
+#define DEFAULT_MUL_THRESHOLD (128 * 128 * 128)
+#define DEFAULT_MUL_THREADS -1
+long MUL_THRESHOLD;
+int MUL_THREADS;
+
+// STAGED PIPELINE FLAG
+// 0 - producers generate matrices, consumers do everything else
+// 1 - generate, checksum, pair, multiply and output are stages with worker
+//     counts of their own, joined by bounded queues (--stages)
+int STAGED;
+
+// PROCESS MODE FLAG
+// 0 - producers and consumers are threads of this process
+// 1 - every producer and consumer is a process of its own; the buffer and
+//     the matrices in it live in a POSIX shared-memory segment (--processes)
+int PROCESSES;
+
+// LATENCY FLAG
+// 0 - only totals are kept
+// 1 - every matrix is timestamped, and percentiles of how long matrices sat
+//     in the buffer and took from generation to output are reported
+int LATENCY;
+
+// CHAIN LENGTH
+// 0 - consumers multiply pairs
+// N - consumers collect chains of up to N compatible matrices, 2-CHAIN_MAX,
+//     and multiply each in the order with the fewest multiply-adds (--chain)
+int CHAIN_LENGTH;
+
+// PRODUCT CACHE
+// 0 - every product is computed
+// N - products are kept in a cache of up to N MiB shared by the consumers,
+//     and a pair seen before is looked up instead of multiplied (--product-cache)
+int PRODUCT_CACHE;
+
+// WAIT MODE
+// How threads wait on the condvar buffer when it is full or empty
+// block    - straight into pthread_cond_wait(), everyone woken at the end
+// adaptive - spin, then yield, then park on a futex, the spin budget tuned
+//            from observed waits; only as many threads woken as have work
+#define WAIT_BLOCK 0
+#define WAIT_ADAPTIVE 1
+#define DEFAULT_WAIT_MODE WAIT_BLOCK
+int WAIT_MODE;
+
+// PAIR BATCHING
+// Consumers collect up to PAIR_BATCH compatible pairs of one tiny shape and
+// multiply them together, vectorized across the pairs; below 2 every pair
+// is multiplied on its own, which keeps each consumer's results in the order
+// it took the pairs
+#define DEFAULT_PAIR_BATCH 0
+int PAIR_BATCH;
+
+// AFFINITY MODE
+// none    - the scheduler places worker threads
+// compact - producer/consumer pairs fill one NUMA node's CPUs before the next
+// scatter - producer/consumer pairs are spread round robin over the NUMA nodes
+// list    - each side is pinned to its --producer-cpus / --consumer-cpus list
+// Producer i and consumer i always share a node under compact and scatter
+#define AFFINITY_NONE 0
+#define AFFINITY_COMPACT 1
+#define AFFINITY_SCATTER 2
+#define AFFINITY_LIST 3
+#define DEFAULT_AFFINITY AFFINITY_NONE
+int AFFINITY;
+
+// MATRIX INPUT FLAG
+// 0 - producers generate random matrices
+// 1 - producers replay the matrix records of the --input files
+int MATRIX_INPUT;
+
+// ADAPTIVE SCALING FLAG
+// 0 - every producer and consumer runs for the whole run
+// 1 - a controller parks and unparks workers on each side to keep the pipeline balanced
+#define DEFAULT_ADAPTIVE 0
+int ADAPTIVE;
+
+// RANDOM SEED
+// Producer i draws its matrices from stream i of this seed
+// Taken from the clock unless given with --seed
+unsigned long RANDOM_SEED;
+
+// RESULT OUTPUT
+// text   - consumers format results as text for the writer thread
+// quiet  - results are not formatted or written at all
+// binary - results are written as binary matrix records
+// products - only the products are written, as binary matrix records
+#define RESULT_TEXT 0
+#define RESULT_QUIET 1
+#define RESULT_BINARY 2
+#define RESULT_PRODUCTS 3
+#define DEFAULT_RESULT_OUTPUT RESULT_TEXT
+int RESULT_OUTPUT;
@@ -0,0 +1,490 @@
+/*
+ *  procs module
+ *  Producers and consumers as separate processes sharing memory
+ *
+ *  The bounded buffer and every matrix a producer makes live in one POSIX
+ *  shared-memory segment.  The parent maps it and forks one process per
+ *  producer and per consumer, each running the usual prod_worker() or
+ *  cons_worker().  A producer builds its matrices straight into free
+ *  slots of the segment and puts their offsets into the buffer; the
+ *  consumer that takes an offset reads the matrix in place and hands the
+ *  slot back, so nothing is copied between processes.  Products and
+ *  output stay private to the consumer that made them.
+ *
+ *  The buffer is the condvar buffer with a process-shared, robust mutex;
+ *  workers wait with the lock dropped on futexes in the segment, as in
+ *  the adaptive wait mode.  Producers take free slots and consumers return used ones a batch at a
+ *  time, in the same critical section as their buffer operation.  Enough
+ *  slots are made for everything the workers can hold at once, so nobody
+ *  waits for a slot unless a worker died holding some.
+ *
+ *  A worker that crashes takes only itself down: the parent sees it exit,
+ *  marks the run aborted and wakes everyone, and the produced/consumed
+ *  sums come out short.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "counter.h"
+#include "element.h"
+#include "matrix.h"
+#include "ring.h"
+#include "steal.h"
+#include "match.h"
+#include "lanes.h"
+#include "output.h"
+#include "pairbatch.h"
+#include "adapt.h"
+#include "affinity.h"
+#include "mulpool.h"
+#include "input.h"
+#include "park.h"
+#include "latency.h"
+#include "chain.h"
+#include "prodcache.h"
+#include "pcmatrix.h"
+#include "prodcons.h"
+#include "procs.h"
+
+// Size of the header in front of a slot's elements, as in the matrix pool
+#define PROCS_HEADER_SIZE ((sizeof(Matrix) + MATRIX_ALIGN - 1) & ~(size_t) (MATRIX_ALIGN - 1))
+
+static ProcSegment * seg; // mapped before the workers are forked
+
+// This process's slots outside the segment's lists: free slots a producer
+// builds matrices in, or used slots a consumer gives back on its next fetch
+static size_t * spare;
+static int nspare;
+
+static inline size_t * procs_buffer()
+{
+  return (size_t *) ((char *) seg + seg->buffer);
+}
+
+static inline size_t * procs_freelist()
+{
+  return (size_t *) ((char *) seg + seg->freelist);
+}
+
+static inline ProcStats * procs_stats()
+{
+  return (ProcStats *) ((char *) seg + seg->stats);
+}
+
+// The matrix in the slot at offset off, its data pointed at this process's mapping
+static Matrix * procs_matrix(size_t off)
+{
+  Matrix * mat = (Matrix *) ((char *) seg + off);
+  mat->data = (Element *) ((char *) mat + PROCS_HEADER_SIZE);
+  return mat;
+}
+
+// Wake everyone waiting on the segment
+static void procs_wake_all()
+{
+  park_wake(&seg->space_lot, INT_MAX);
+  park_wake(&seg->data_lot, INT_MAX);
+  park_wake(&seg->slot_lot, INT_MAX);
+}
+
+// A worker died holding the lock and its update may be half done,
+// so the lock is made usable again only to abort the run
+static void procs_owner_died(int rc)
+{
+  if (rc != EOWNERDEAD)
+    return;
+  atomic_store(&seg->aborted, 1);
+  pthread_mutex_consistent(&seg->lock);
+  procs_wake_all();
+}
+
+static void procs_lock()
+{
+  procs_owner_died(pthread_mutex_lock(&seg->lock));
+}
+
+// Conditions waiters check without the lock, an aborted run ends every wait
+static int procs_has_space(void * arg)
+{
+  return atomic_load(&seg->count) < seg->capacity || atomic_load(&seg->aborted);
+}
+
+static int procs_has_data(void * arg)
+{
+  return atomic_load(&seg->count) > 0 || atomic_load(&seg->aborted);
+}
+
+static int procs_has_slots(void * arg)
+{
+  return atomic_load(&seg->nfree) > 0 || atomic_load(&seg->aborted);
+}
+
+// Drop the lock, wait on lot until ready() holds, then take the lock back
+static void procs_park(ParkLot * lot, int (*ready)(void *))
+{
+  pthread_mutex_unlock(&seg->lock);
+  park_wait(lot, ready, NULL);
+  procs_lock();
+}
+
+// Leave the run after another worker died, caller holds the lock
+static void procs_give_up()
+{
+  pthread_mutex_unlock(&seg->lock);
+  _exit(PROCS_EXIT_ABORTED);
+}
+
+// Move up to n slots from the free list to this producer's spare slots,
+// waiting for one if wait is set and the list is empty; caller holds the lock
+static void procs_take_slots(int n, int wait)
+{
+  while (wait && seg->nfree == 0 && !atomic_load(&seg->aborted))
+    procs_park(&seg->slot_lot, procs_has_slots);
+  if (atomic_load(&seg->aborted))
+    procs_give_up();
+  size_t * freelist = procs_freelist();
+  while (n-- > 0 && seg->nfree > 0)
+    spare[nspare++] = freelist[--seg->nfree];
+}
+
+// Allocator of producer processes: a free slot shaped r x c
+static Matrix * procs_alloc(int r, int c)
+{
+  assert((long) r * c <= seg->slot_elements);
+  if (nspare == 0) {
+    procs_lock();
+    procs_take_slots(BATCH_SIZE, 1);
+    pthread_mutex_unlock(&seg->lock);
+  }
+  Matrix * mat = procs_matrix(spare[--nspare]);
+  mat->rows = r;
+  mat->cols = c;
+  mat->pool_class = MATRIX_SHARED;
+  mat->node = 0;
+  mat->next = NULL;
+  return mat;
+}
+
+// Release for every worker process: the slot goes back on the next fetch
+static void procs_release(Matrix * mat)
+{
+  spare[nspare++] = (char *) mat - (char *) seg;
+}
+
+// put n matrices into the shared buffer, waiting whenever it is full,
+// then refill this producer's spare slots for the next batch
+// Replayed matrices are copied into slots here, generated ones were built in one
+void procs_publish(Matrix ** values, int n)
+{
+  for (int i = 0; i < n; i++)
+    if (values[i]->pool_class != MATRIX_SHARED) {
+      Matrix * mat = procs_alloc(values[i]->rows, values[i]->cols);
+      memcpy(mat->data, values[i]->data, sizeof(Element) * values[i]->rows * values[i]->cols);
+      mat->born = values[i]->born;
+      mat->enqueued = values[i]->enqueued;
+      FreeMatrix(values[i]);
+      values[i] = mat;
+    }
+  size_t * buffer = procs_buffer();
+  int done = 0;
+  procs_lock();
+  while (done < n) {
+    while (seg->count == seg->capacity && !atomic_load(&seg->aborted))
+      procs_park(&seg->space_lot, procs_has_space);
+    if (atomic_load(&seg->aborted))
+      procs_give_up();
+    int room = seg->capacity - seg->count;
+    int k = n - done < room ? n - done : room;
+    for (int i = 0; i < k; i++) {
+      buffer[seg->fill] = (char *) values[done + i] - (char *) seg;
+      seg->fill = (seg->fill + 1) % seg->capacity;
+    }
+    seg->count += k;
+    done += k;
+    park_wake(&seg->data_lot, k); // as many consumers as there are new matrices
+  }
+  if (nspare < BATCH_SIZE)
+    procs_take_slots(BATCH_SIZE - nspare, 0); // whatever is free, without waiting
+  pthread_mutex_unlock(&seg->lock);
+}
+
+// Reserve up to max of the NUMBER_OF_MATRICES matrices as ring_fetch() does,
+// then take that many from the shared buffer, waiting while it is empty
+// The slots this consumer used since its last fetch go back first
+// Returns the number taken, 0 once all matrices have been claimed
+int procs_fetch(Matrix ** values, int max)
+{
+  int claimed = atomic_fetch_add(&seg->claimed, max);
+  if (claimed >= NUMBER_OF_MATRICES)
+    return 0; // all matrices already claimed by consumers
+  int k = NUMBER_OF_MATRICES - claimed < max ? NUMBER_OF_MATRICES - claimed : max;
+  size_t * buffer = procs_buffer();
+  size_t * freelist = procs_freelist();
+  procs_lock();
+  if (nspare > 0) {
+    memcpy(freelist + seg->nfree, spare, sizeof(size_t) * nspare);
+    seg->nfree += nspare;
+    nspare = 0;
+    park_wake(&seg->slot_lot, INT_MAX);
+  }
+  int done = 0;
+  while (done < k) {
+    while (seg->count == 0 && !atomic_load(&seg->aborted))
+      procs_park(&seg->data_lot, procs_has_data);
+    if (atomic_load(&seg->aborted))
+      procs_give_up();
+    int t = k - done < seg->count ? k - done : seg->count;
+    for (int i = 0; i < t; i++) {
+      values[done + i] = (Matrix *) buffer[seg->use]; // just the offset until the lock is dropped
+      seg->use = (seg->use + 1) % seg->capacity;
+    }
+    seg->count -= t;
+    done += t;
+    park_wake(&seg->space_lot, t);
+  }
+  pthread_mutex_unlock(&seg->lock);
+  for (int i = 0; i < k; i++)
+    values[i] = procs_matrix((size_t) values[i]);
+  return k;
+}
+
+// Slots the workers can hold at once: the buffer, a producer's unpublished
+// batch and spare slots, and a consumer's batch plus either the chain it is
+// building or the first matrix it carries into the next fetch and the pairs
+// waiting in its pair batch; chain intermediates and products are private
+static int procs_slots_needed(int nprod, int ncons, int pair_batch)
+{
+  int pairs = pair_batch >= 2 ? 2 * (pair_batch - 1) * PAIRBATCH_MAX_DIM * PAIRBATCH_MAX_DIM * PAIRBATCH_MAX_DIM : 0;
+  int held = CHAIN_LENGTH ? CHAIN_LENGTH : 1 + pairs;
+  return BOUNDED_BUFFER_SIZE + nprod * 2 * BATCH_SIZE + ncons * (BATCH_SIZE + held);
+}
+
+// Create, size and map the segment, then unlink its name: the workers
+// inherit the mapping, and it disappears with the last of them
+static int procs_map(int nprod, int ncons, long elements, int pair_batch)
+{
+  int nslots = procs_slots_needed(nprod, ncons, pair_batch);
+  size_t slot_size = (PROCS_HEADER_SIZE + sizeof(Element) * elements + MATRIX_ALIGN - 1) & ~(size_t) (MATRIX_ALIGN - 1);
+  size_t buffer = (sizeof(ProcSegment) + CACHE_LINE_SIZE - 1) & ~(size_t) (CACHE_LINE_SIZE - 1);
+  size_t freelist = buffer + sizeof(size_t) * BOUNDED_BUFFER_SIZE;
+  size_t stats = freelist + sizeof(size_t) * nslots;
+  size_t slots = (stats + sizeof(ProcStats) * (nprod + ncons) + MATRIX_ALIGN - 1) & ~(size_t) (MATRIX_ALIGN - 1);
+  size_t size = slots + slot_size * nslots;
+
+  char name[64];
+  snprintf(name, sizeof(name), "/pcmatrix.%d", (int) getpid());
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) {
+    perror(name);
+    return -1;
+  }
+  shm_unlink(name);
+  if (ftruncate(fd, size) != 0) {
+    perror(name);
+    close(fd);
+    return -1;
+  }
+  seg = (ProcSegment *) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd); // the mapping keeps the segment
+  if (seg == MAP_FAILED) {
+    perror(name);
+    seg = NULL;
+    return -1;
+  }
+
+  // fresh pages are zero, only the non-zero fields need setting
+  pthread_mutexattr_t mattr;
+  pthread_mutexattr_init(&mattr);
+  pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(&seg->lock, &mattr);
+  pthread_mutexattr_destroy(&mattr);
+  park_init_shared(&seg->space_lot);
+  park_init_shared(&seg->data_lot);
+  park_init_shared(&seg->slot_lot);
+  seg->capacity = BOUNDED_BUFFER_SIZE;
+  seg->nslots = nslots;
+  seg->slot_size = slot_size;
+  seg->slot_elements = elements;
+  seg->buffer = buffer;
+  seg->freelist = freelist;
+  seg->stats = stats;
+  seg->slots = slots;
+  seg->size = size;
+  size_t * list = procs_freelist();
+  for (int i = 0; i < nslots; i++)
+    list[i] = slots + slot_size * (nslots - 1 - i); // lowest slots are taken first
+  seg->nfree = nslots;
+  return 0;
+}
+
+// Body of producer process id, produces work matrices starting at record first
+static void procs_producer(int id, int work, long first)
+{
+  spare = (size_t *) malloc(sizeof(size_t) * 2 * BATCH_SIZE);
+  MatrixSetShared(procs_alloc, procs_release);
+  if (MATRIX_INPUT)
+    input_seek(first); // every producer process has a cursor of its own
+  ProducerArgs * args = (ProducerArgs *) malloc(sizeof(ProducerArgs));
+  args->id = id;
+  args->work = work;
+  ProdConsStats * stats = (ProdConsStats *) prod_worker(args);
+  ProcStats * out = &procs_stats()[id];
+  out->stats = *stats;
+  out->finished = 1;
+}
+
+// Body of consumer process id, its results go to output_fd
+// pool_threads - this consumer's share of the multiply pool
+static void procs_consumer(int id, int nprod, int ncons, int output_fd, int pair_batch, int pool_threads)
+{
+  PAIR_BATCH = pair_batch; // this process's copy, the slots were sized for it
+  spare = (size_t *) malloc(sizeof(size_t) * seg->nslots);
+  MatrixSetShared(NULL, procs_release); // products are private, only the slots go back
+  discardc = (sharded_counter_t *) malloc(sizeof(sharded_counter_t));
+  init_shcnt(discardc, ncons);
+  if (RESULT_OUTPUT != RESULT_QUIET)
+    output_start(output_fd, 1);
+  mulpool_start(pool_threads, 0);
+  int * arg = (int *) malloc(sizeof(int));
+  *arg = id;
+  ProdConsStats * stats = (ProdConsStats *) cons_worker(arg);
+  output_stop();
+  mulpool_stop();
+  ProcStats * out = &procs_stats()[nprod + id];
+  out->stats = *stats;
+  out->discarded = get_shcnt(discardc);
+  latency_collect(&out->latency);
+  chain_collect(&out->chain);
+  prodcache_collect(&out->cache);
+  out->finished = 1;
+}
+
+// Parent side of a worker's exit: anything but a clean exit aborts the run
+// Returns 1 if the worker died, 0 if it finished or gave up
+static int procs_reap(pid_t pid, int status, pid_t * pids, int nprod, int ncons)
+{
+  if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+    return 0;
+  int i = 0;
+  while (i < nprod + ncons && pids[i] != pid)
+    i++;
+  const char * role = i < nprod ? "producer" : "consumer";
+  int id = i < nprod ? i : i - nprod;
+  if (WIFSIGNALED(status))
+    fprintf(stderr, "%s %d (pid %d) killed by signal %d, aborting the run\n", role, id, (int) pid, WTERMSIG(status));
+  else if (WEXITSTATUS(status) != PROCS_EXIT_ABORTED)
+    fprintf(stderr, "%s %d (pid %d) exited with status %d, aborting the run\n", role, id, (int) pid, WEXITSTATUS(status));
+  procs_lock();
+  atomic_store(&seg->aborted, 1);
+  procs_wake_all();
+  pthread_mutex_unlock(&seg->lock);
+  return !WIFEXITED(status) || WEXITSTATUS(status) != PROCS_EXIT_ABORTED;
+}
+
+// Run every producer and consumer once as a process of its own and
+// aggregate the statistics they left in the segment into totals
+// Results go to output_fd unless RESULT_OUTPUT is quiet
+void procs_run(int nprod, int ncons, int output_fd, RunTotals * totals)
+{
+  memset(totals, 0, sizeof(*totals));
+  long elements = MATRIX_INPUT ? input_largest() : MATRIX_MODE == 0 ? RANDOM_MAX_DIM * RANDOM_MAX_DIM : (long) MATRIX_MODE * MATRIX_MODE;
+  // pair batching is not worth reserving every slot size for the few pairs
+  // that would batch; PAIR_BATCH is left as the user set it for the report
+  static int warned = 0;
+  int pair_batch = PAIR_BATCH;
+  if (CHAIN_LENGTH)
+    pair_batch = 0; // chains never batch pairs
+  else if (pair_batch >= 2 && elements > PAIRBATCH_MAX_DIM * PAIRBATCH_MAX_DIM) {
+    if (!warned++)
+      fprintf(stderr, "Pair batching disabled: with --processes it needs matrices of at most %dx%d elements, these have up to %ld\n",
+              PAIRBATCH_MAX_DIM, PAIRBATCH_MAX_DIM, elements);
+    pair_batch = 0;
+  }
+  // every consumer process has a pool of its own, they split the one a
+  // threaded run would start
+  int pool = mulpool_size(MUL_THREADS, nprod + ncons);
+  if (procs_map(nprod, ncons, elements, pair_batch) < 0) {
+    totals->failed = nprod + ncons; // nothing ran
+    return;
+  }
+
+  fflush(stdout); // everything printed so far must come out before the results, once
+  affinity_plan(nprod, ncons);
+  pid_t * pids = (pid_t *) calloc(nprod + ncons, sizeof(pid_t));
+  int per_producer = NUMBER_OF_MATRICES / nprod;
+  int remainder = NUMBER_OF_MATRICES % nprod;
+  long first = 0; // first input record of the next producer
+  for (int i = 0; i < nprod + ncons; i++) {
+    int work = i < nprod ? per_producer + (i < remainder ? 1 : 0) : 0;
+    if ((pids[i] = fork()) == 0) {
+      if (i < nprod)
+        procs_producer(i, work, first);
+      else
+        procs_consumer(i - nprod, nprod, ncons, output_fd, pair_batch,
+                       pool / ncons + (i - nprod < pool % ncons ? 1 : 0));
+      _exit(0); // skip the stdio buffers and exit handlers copied from the parent
+    }
+    if (pids[i] < 0) {
+      perror("fork");
+      pids[i] = 0;
+      totals->failed++;
+      procs_lock();
+      atomic_store(&seg->aborted, 1); // a missing worker would leave the others waiting
+      procs_wake_all();
+      pthread_mutex_unlock(&seg->lock);
+      break;
+    }
+    first += work;
+  }
+
+  int status;
+  pid_t pid;
+  while ((pid = wait(&status)) > 0 || (pid < 0 && errno == EINTR))
+    if (pid > 0)
+      totals->failed += procs_reap(pid, status, pids, nprod, ncons);
+
+  // a worker that died or gave up never wrote its statistics, or only
+  // some of them; the run is reported as aborted either way
+  ProcStats * stats = procs_stats();
+  for (int i = 0; i < nprod; i++) {
+    if (!stats[i].finished)
+      continue;
+    totals->produced += stats[i].stats.matrixtotal;
+    totals->prodsum += stats[i].stats.sumtotal;
+  }
+  for (int i = nprod; i < nprod + ncons; i++) {
+    if (!stats[i].finished)
+      continue;
+    totals->consumed += stats[i].stats.matrixtotal;
+    totals->conssum += stats[i].stats.sumtotal;
+    totals->multiplied += stats[i].stats.multtotal;
+    totals->discarded += stats[i].discarded;
+    latency_merge(&stats[i].latency);
+    chain_merge(&stats[i].chain);
+    prodcache_merge(&stats[i].cache);
+  }
+  totals->adapt.producers = nprod;
+  totals->adapt.consumers = ncons;
+  totals->adapt.mean_producers = nprod;
+  totals->adapt.mean_consumers = ncons;
+
+  free(pids);
+  pthread_mutex_destroy(&seg->lock);
+  munmap(seg, seg->size);
+  seg = NULL;
+}
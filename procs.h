@@ -0,0 +1,56 @@
+/*
+ *  procs header
+ *  Function prototypes, data, and constants for the shared-memory multi-process mode
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Exit status of a worker that gave up because another worker died
+#define PROCS_EXIT_ABORTED 2
+
+// What a worker process reports back through the segment
+// finished - set as the worker's last act, still 0 if it died
+typedef struct proc_stats {
+  ProdConsStats stats;
+  long discarded;
+  LatencyStats latency;
+  ChainStats chain;
+  ProdCacheStats cache;
+  int finished;
+} ProcStats;
+
+// The shared-memory segment, mapped by the parent and inherited by every
+// worker process.  Matrices live in fixed-size slots behind the header and
+// pass between processes as offsets from the start of the segment.
+// lock     - robust and process-shared, guards the buffer and the free list
+// capacity - bounded buffer slots, fill/use/count as in the condvar buffer
+// nfree    - slots on the free list
+// claimed  - matrices reserved by consumers, as conc in ring mode
+// aborted  - a worker died, the others give up
+// lots     - where producers wait for space or slots and consumers for data,
+//            futexes rather than condition variables, which a waiter that
+//            dies can leave unusable
+// buffer, freelist, stats, slots - offsets of the segment's arrays
+typedef struct proc_segment {
+  pthread_mutex_t lock;
+  ParkLot space_lot;
+  ParkLot data_lot;
+  ParkLot slot_lot;
+  int capacity;
+  int fill, use;
+  _Atomic int count;
+  _Atomic int nfree;
+  _Atomic int claimed;
+  _Atomic int aborted;
+  int nslots;
+  size_t slot_size;
+  long slot_elements;
+  size_t buffer, freelist, stats, slots;
+  size_t size;
+} ProcSegment;
+
+// procs methods
+void procs_run(int nprod, int ncons, int output_fd, RunTotals * totals);
+void procs_publish(Matrix ** values, int n);
+int procs_fetch(Matrix ** values, int max);
@@ -0,0 +1,321 @@
+/*
+ *  prodcache module
+ *  A product cache shared by the consumers, keyed by the operands' contents
+ *
+ *  In a fixed matrix mode every matrix is all ones, and in mode 0 the
+ *  smallest shapes have only a few hundred possible contents, so the same
+ *  product is computed over and over.  With --product-cache a consumer
+ *  first hashes the shapes and elements of both operands and looks the
+ *  pair up; a hit copies the cached product instead of multiplying, a
+ *  miss multiplies and leaves the product for the next consumer.
+ *
+ *  The cache holds at most PRODUCT_CACHE MiB of entries, split over
+ *  PRODCACHE_SHARDS shards with a lock each.  When a shard is full a
+ *  CLOCK hand sweeps its entries: one looked up since the hand's last pass
+ *  gets another round, the first one that was not is evicted.  That is
+ *  close to LRU without touching a list on every hit.
+ *
+ *  Entries keep copies of both operands, a hit is only a hit if they
+ *  match element for element, so a hash collision can never return the
+ *  wrong product.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "counter.h"
+#include "element.h"
+#include "matrix.h"
+#include "prodcache.h"
+#include "pcmatrix.h"
+
+#define PRODCACHE_MULT 0x9E3779B97F4A7C15UL // 2^64 / golden ratio, odd
+
+static ProdCacheShard shards[PRODCACHE_SHARDS];
+static int started = 0;
+
+static _Atomic long oversize; // products too large to cache, counted before any shard is picked
+
+static pthread_mutex_t merged_lock = PTHREAD_MUTEX_INITIALIZER;
+static ProdCacheStats merged; // statistics of worker processes
+
+// Fold the n elements at v into h, eight bytes at a time
+static unsigned long prodcache_mix(unsigned long h, const Element * v, long n)
+{
+  const unsigned char * p = (const unsigned char *) v;
+  size_t len = sizeof(Element) * n, i;
+  unsigned long w;
+  for (i = 0; i + sizeof(w) <= len; i += sizeof(w)) {
+    memcpy(&w, p + i, sizeof(w));
+    h = (h ^ w) * PRODCACHE_MULT;
+    h ^= h >> 29;
+  }
+  if (i < len) {
+    w = 0;
+    memcpy(&w, p + i, len - i);
+    h = (h ^ w) * PRODCACHE_MULT;
+    h ^= h >> 29;
+  }
+  return h;
+}
+
+static unsigned long prodcache_hash(Matrix * m1, Matrix * m2)
+{
+  unsigned long h = ((unsigned long) m1->rows << 42 | (unsigned long) m1->cols << 21 | m2->cols) * PRODCACHE_MULT;
+  h = prodcache_mix(h, m1->data, (long) m1->rows * m1->cols);
+  h = prodcache_mix(h, m2->data, (long) m2->rows * m2->cols);
+  return h ^ (h >> 32);
+}
+
+// Bytes of the entry for m1 x m2
+static inline size_t prodcache_entry_size(Matrix * m1, Matrix * m2)
+{
+  return sizeof(ProdCacheEntry) + sizeof(Product) * ((size_t) m1->rows * m2->cols) +
+         sizeof(Element) * ((size_t) m1->rows * m1->cols + (size_t) m2->rows * m2->cols);
+}
+
+// The operands kept in an entry, behind its product
+static inline Element * prodcache_operands(ProdCacheEntry * e)
+{
+  return (Element *) (e->data + (size_t) e->r1 * e->c2);
+}
+
+// Whether the product of m1 x m2 is worth looking up at all
+static inline int prodcache_fits(Matrix * m1, Matrix * m2)
+{
+  return prodcache_entry_size(m1, m2) <= shards[0].budget / PRODCACHE_MAX_SHARE;
+}
+
+// The shard is picked by the top bits, the bucket by the bottom ones
+static inline ProdCacheShard * prodcache_shard(unsigned long hash)
+{
+  return &shards[(hash >> 58) % PRODCACHE_SHARDS];
+}
+
+// Entry for m1 x m2 in shard s, NULL if there is none
+static ProdCacheEntry * prodcache_find(ProdCacheShard * s, unsigned long hash, Matrix * m1, Matrix * m2)
+{
+  size_t left = sizeof(Element) * m1->rows * m1->cols;
+  for (ProdCacheEntry * e = s->buckets[hash & s->mask]; e != NULL; e = e->next)
+    if (e->hash == hash && e->r1 == m1->rows && e->c1 == m1->cols && e->c2 == m2->cols &&
+        memcmp(prodcache_operands(e), m1->data, left) == 0 &&
+        memcmp(prodcache_operands(e) + m1->rows * m1->cols, m2->data, sizeof(Element) * m2->rows * m2->cols) == 0)
+      return e;
+  return NULL;
+}
+
+// Unlink and free an entry
+static void prodcache_remove(ProdCacheShard * s, ProdCacheEntry * e)
+{
+  ProdCacheEntry ** p = &s->buckets[e->hash & s->mask];
+  while (*p != e)
+    p = &(*p)->next;
+  *p = e->next;
+  s->ring[e->slot] = NULL;
+  s->stats.bytes -= e->size;
+  free(e);
+}
+
+// Advance the clock hand until there is an empty slot and size more bytes
+// fit in the budget, evicting entries that were not referenced on the way
+// Returns the slot
+static int prodcache_make_room(ProdCacheShard * s, size_t size)
+{
+  for (;;) {
+    int i = s->hand;
+    s->hand = s->hand + 1 == s->nslots ? 0 : s->hand + 1;
+    ProdCacheEntry * e = s->ring[i];
+    if (e != NULL) {
+      if (e->referenced) {
+        e->referenced = 0; // another round
+        continue;
+      }
+      prodcache_remove(s, e);
+      s->stats.evictions++;
+    }
+    if (s->stats.bytes + size <= s->budget)
+      return i;
+  }
+}
+
+// Free every entry and clear the statistics, allocating the shards on first use
+void prodcache_reset()
+{
+  if (!PRODUCT_CACHE)
+    return;
+  if (!started) {
+    size_t budget = ((size_t) PRODUCT_CACHE << 20) / PRODCACHE_SHARDS;
+    int nslots = budget / PRODCACHE_MIN_ENTRY;
+    unsigned long nbuckets = 1;
+    while (nbuckets < (unsigned long) nslots)
+      nbuckets <<= 1;
+    for (int i = 0; i < PRODCACHE_SHARDS; i++) {
+      ProdCacheShard * s = &shards[i];
+      pthread_mutex_init(&s->lock, NULL);
+      s->buckets = (ProdCacheEntry **) calloc(nbuckets, sizeof(ProdCacheEntry *));
+      s->ring = (ProdCacheEntry **) calloc(nslots, sizeof(ProdCacheEntry *));
+      assert(s->buckets != 0 && s->ring != 0);
+      s->mask = nbuckets - 1;
+      s->nslots = nslots;
+      s->budget = budget;
+    }
+    started = 1;
+  }
+  for (int i = 0; i < PRODCACHE_SHARDS; i++) {
+    ProdCacheShard * s = &shards[i];
+    pthread_mutex_lock(&s->lock);
+    for (int j = 0; j < s->nslots; j++)
+      if (s->ring[j] != NULL)
+        prodcache_remove(s, s->ring[j]);
+    s->hand = 0;
+    memset(&s->stats, 0, sizeof(s->stats));
+    pthread_mutex_unlock(&s->lock);
+  }
+  oversize = 0;
+  pthread_mutex_lock(&merged_lock);
+  memset(&merged, 0, sizeof(merged));
+  pthread_mutex_unlock(&merged_lock);
+}
+
+// Look up the product of m1 x m2
+// Returns a copy of the cached product, or NULL on a miss or if the
+// operands cannot be multiplied
+Matrix * prodcache_lookup(Matrix * m1, Matrix * m2)
+{
+  if (!PRODUCT_CACHE || m1->cols != m2->rows)
+    return NULL;
+  if (!prodcache_fits(m1, m2)) {
+    atomic_fetch_add(&oversize, 1); // not hashed, never inserted
+    return NULL;
+  }
+  unsigned long hash = prodcache_hash(m1, m2);
+  ProdCacheShard * s = prodcache_shard(hash);
+  Matrix * product = NULL;
+  pthread_mutex_lock(&s->lock);
+  ProdCacheEntry * e = prodcache_find(s, hash, m1, m2);
+  if (e != NULL) {
+    e->referenced = 1;
+    s->stats.hits++;
+    product = AllocProduct(m1->rows, m2->cols);
+    memcpy(product->product, e->data, sizeof(Product) * m1->rows * m2->cols);
+  }
+  else
+    s->stats.misses++;
+  pthread_mutex_unlock(&s->lock);
+  return product;
+}
+
+// Keep product, the result of m1 x m2, for later lookups
+void prodcache_insert(Matrix * m1, Matrix * m2, Matrix * product)
+{
+  if (!PRODUCT_CACHE || !prodcache_fits(m1, m2))
+    return; // counted by the lookup
+  long a = (long) m1->rows * m1->cols, b = (long) m2->rows * m2->cols, c = (long) product->rows * product->cols;
+  size_t size = prodcache_entry_size(m1, m2);
+  unsigned long hash = prodcache_hash(m1, m2);
+  ProdCacheShard * s = prodcache_shard(hash);
+
+  // fill the entry in before taking the lock
+  ProdCacheEntry * e = (ProdCacheEntry *) malloc(size);
+  assert(e != 0);
+  e->hash = hash;
+  e->r1 = m1->rows;
+  e->c1 = m1->cols;
+  e->c2 = m2->cols;
+  e->referenced = 0;
+  e->size = size;
+  memcpy(e->data, product->product, sizeof(Product) * c);
+  memcpy(prodcache_operands(e), m1->data, sizeof(Element) * a);
+  memcpy(prodcache_operands(e) + a, m2->data, sizeof(Element) * b);
+
+  pthread_mutex_lock(&s->lock);
+  if (prodcache_find(s, hash, m1, m2) != NULL) { // another consumer got there first
+    pthread_mutex_unlock(&s->lock);
+    free(e);
+    return;
+  }
+  e->slot = prodcache_make_room(s, size);
+  s->ring[e->slot] = e;
+  e->next = s->buckets[hash & s->mask];
+  s->buckets[hash & s->mask] = e;
+  s->stats.bytes += size;
+  s->stats.inserts++;
+  pthread_mutex_unlock(&s->lock);
+}
+
+// m1 x m2 from the cache if it is there, multiplied and cached if not
+// Returns NULL if the operands cannot be multiplied, as MatrixMultiply()
+Matrix * prodcache_multiply(Matrix * m1, Matrix * m2)
+{
+  Matrix * product = prodcache_lookup(m1, m2);
+  if (product == NULL && (product = MatrixMultiply(m1, m2)) != NULL)
+    prodcache_insert(m1, m2, product);
+  return product;
+}
+
+static void prodcache_add_stats(ProdCacheStats * to, ProdCacheStats * from)
+{
+  to->hits += from->hits;
+  to->misses += from->misses;
+  to->inserts += from->inserts;
+  to->evictions += from->evictions;
+  to->oversize += from->oversize;
+  to->bytes += from->bytes;
+}
+
+// Totals of every shard and every worker process merged so far
+void prodcache_collect(ProdCacheStats * stats)
+{
+  memset(stats, 0, sizeof(*stats));
+  if (!started)
+    return;
+  for (int i = 0; i < PRODCACHE_SHARDS; i++) {
+    pthread_mutex_lock(&shards[i].lock);
+    prodcache_add_stats(stats, &shards[i].stats);
+    pthread_mutex_unlock(&shards[i].lock);
+  }
+  stats->oversize += oversize;
+  pthread_mutex_lock(&merged_lock);
+  prodcache_add_stats(stats, &merged);
+  pthread_mutex_unlock(&merged_lock);
+}
+
+// Add the statistics of a worker process's own cache
+void prodcache_merge(ProdCacheStats * stats)
+{
+  pthread_mutex_lock(&merged_lock);
+  prodcache_add_stats(&merged, stats);
+  pthread_mutex_unlock(&merged_lock);
+}
+
+void prodcache_report(FILE * stream)
+{
+  ProdCacheStats t;
+  prodcache_collect(&t);
+  long lookups = t.hits + t.misses;
+  fprintf(stream, "Product cache: %ld hits, %ld misses (%.1f%% hit rate), %ld inserted, %ld evicted, %ld too large to cache\n",
+          t.hits, t.misses, lookups ? 100.0 * t.hits / lookups : 0.0, t.inserts, t.evictions, t.oversize);
+  fprintf(stream, "Product cache memory: %.2f MiB held at the end, budget %d MiB\n", t.bytes / 1048576.0, PRODUCT_CACHE);
+}
+
+void prodcache_destroy()
+{
+  if (!started)
+    return;
+  for (int i = 0; i < PRODCACHE_SHARDS; i++) {
+    ProdCacheShard * s = &shards[i];
+    for (int j = 0; j < s->nslots; j++)
+      if (s->ring[j] != NULL)
+        prodcache_remove(s, s->ring[j]);
+    free(s->buckets);
+    free(s->ring);
+    pthread_mutex_destroy(&s->lock);
+  }
+  started = 0;
+}
@@ -0,0 +1,68 @@
+/*
+ *  prodcache header
+ *  Function prototypes, data, and constants for the shared product cache
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Independently locked parts of the cache, picked by the key's hash
+#define PRODCACHE_SHARDS 16
+
+// Smallest entry assumed when sizing a shard's table and clock ring
+#define PRODCACHE_MIN_ENTRY 64
+
+// An entry larger than 1/PRODCACHE_MAX_SHARE of a shard is never cached,
+// so one huge product cannot flush everything else
+#define PRODCACHE_MAX_SHARE 8
+
+// A cached product and the operands it was computed from
+// next       - next entry in the same hash bucket
+// slot       - where the entry sits on the clock ring
+// referenced - looked up since the clock hand last passed
+// data       - r1 x c2 product, followed by the r1 x c1 left and c1 x c2
+//              right operands as Elements
+typedef struct prodcache_entry {
+  struct prodcache_entry * next;
+  unsigned long hash;
+  int r1, c1, c2;
+  int slot;
+  int referenced;
+  size_t size;
+  Product data[];
+} ProdCacheEntry;
+
+// Lookups and what became of the products
+// oversize - lookups of products too large to cache
+// bytes    - held by entries at the time the statistics were taken
+typedef struct prodcache_stats {
+  long hits;
+  long misses;
+  long inserts;
+  long evictions;
+  long oversize;
+  size_t bytes;
+} ProdCacheStats;
+
+// One shard: a chained hash table over its entries and a clock ring of
+// nslots slots, the hand evicting entries not referenced since its last pass
+typedef struct prodcache_shard {
+  pthread_mutex_t lock;
+  ProdCacheEntry ** buckets;
+  ProdCacheEntry ** ring;
+  unsigned long mask; // buckets - 1
+  int nslots;
+  int hand;
+  size_t budget;
+  ProdCacheStats stats;
+} __attribute__((aligned(CACHE_LINE_SIZE))) ProdCacheShard;
+
+// prodcache methods, all no-ops unless PRODUCT_CACHE is set
+void prodcache_reset();
+Matrix * prodcache_lookup(Matrix * m1, Matrix * m2);
+void prodcache_insert(Matrix * m1, Matrix * m2, Matrix * product);
+Matrix * prodcache_multiply(Matrix * m1, Matrix * m2);
+void prodcache_collect(ProdCacheStats * stats);
+void prodcache_merge(ProdCacheStats * stats);
+void prodcache_report(FILE * stream);
+void prodcache_destroy();
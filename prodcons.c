@@ -12,11 +12,28 @@
 // Include only libraries for this module
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <pthread.h>
 #include "counter.h"
+#include "element.h"
 #include "matrix.h"
+#include "chain.h"
+#include "prodcache.h"
+#include "ring.h"
+#include "steal.h"
+#include "match.h"
+#include "lanes.h"
+#include "output.h"
+#include "pairbatch.h"
+#include "instrument.h"
+#include "adapt.h"
+#include "affinity.h"
+#include "input.h"
+#include "park.h"
+#include "latency.h"
 #include "pcmatrix.h"
 #include "prodcons.h"
+#include "procs.h"
 
 
 // Define Locks, Condition variables, and so on here
@@ -25,39 +42,22 @@ int use = 0; // index of next getable slot in buffer, only accessed by consumers
 pthread_cond_t empty = PTHREAD_COND_INITIALIZER; // condition variable that producers wait on when buffer is full
 pthread_cond_t full = PTHREAD_COND_INITIALIZER; // condition variable that consumers wait on when buffer is empty
 pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER; // mutex that controls access to the buffer
+pthread_cond_t partner = PTHREAD_COND_INITIALIZER; // condition variable that matching consumers wait on for a compatible matrix
+static __thread int home = 0; // the calling worker's own queue in steal mode
+static ParkLot space_lot; // producers waiting for space in the condvar buffer, adaptive wait mode
+static ParkLot data_lot; // consumers waiting for data in the condvar buffer, adaptive wait mode
 
-// Helper function to handle consumer termination cleanup
-// Wakes other consumers, unlocks mutex, frees m1 if provided, returns stats
-void* cleanup_and_exit_consumer(Matrix *m1, ProdConsStats *stats)
-{
-  pthread_cond_broadcast(&full);  // Wake up other waiting consumers
-  pthread_mutex_unlock(&mutex); // Ensure mutex is unlocked
-  if (m1 != NULL) {
-    FreeMatrix(m1); // Free matrix if provided
-  }
-  return (void*) stats; // Return stats
-}
+// Bounded buffer put() get() routines
 
-// Helper function to wait for buffer data and check if work is done
-// Waits while buffer is empty, then checks if all matrices consumed
-// Returns cleanup_and_exit_consumer result if done, NULL if can continue
-// Must be called while holding the mutex
-void* wait_for_buffer_or_exit(Matrix *m, ProdConsStats *cons)
+// empty the bounded buffer indices before a run
+void reset_buffer()
 {
-  // wait while the buffer is empty and the work is not done
-  while (get_cnt(prodc) == get_cnt(conc) && get_cnt(conc) < NUMBER_OF_MATRICES)
-    pthread_cond_wait(&full, &mutex);
-
-  // After waking, check if we've consumed all matrices
-  if (get_cnt(conc) >= NUMBER_OF_MATRICES) {
-    return cleanup_and_exit_consumer(m, cons);
-  }
-
-  return NULL; // Can continue
+  fill = 0;
+  use = 0;
+  park_init(&space_lot);
+  park_init(&data_lot);
 }
 
-// Bounded buffer put() get() routines
-
 // put a matrix into the bounded buffer
 int put(Matrix * value) 
 {
@@ -76,13 +76,366 @@ Matrix * get()
   return tmp; // return matrix
 }
 
+// put n matrices into the bounded buffer, caller must hold the mutex and make sure they fit
+int put_many(Matrix ** values, int n)
+{
+  for (int i = 0; i < n; i++) {
+    bigmatrix[fill] = values[i]; // put matrix into buffer
+    fill = (fill + 1) % BOUNDED_BUFFER_SIZE; // update fill index
+  }
+  add_cnt(prodc, n); // one counter update for the whole batch
+  return get_cnt(prodc); // return total number of produced matrices
+}
+
+// get n matrices from the bounded buffer, caller must hold the mutex and make sure they exist
+int get_many(Matrix ** values, int n)
+{
+  for (int i = 0; i < n; i++) {
+    values[i] = bigmatrix[use]; // get matrix from buffer
+    use = (use + 1) % BOUNDED_BUFFER_SIZE; // update use index
+  }
+  add_cnt(conc, n); // one counter update for the whole batch
+  return n; // return number of matrices taken
+}
+
+
+// Blocking publish/fetch routines used by the worker threads
+// Move up to a batch of matrices per lock acquisition and dispatch to the
+// condition variable buffer or the lock-free ring depending on BUFFER_MODE
+
+// Conditions adaptive waiters on the condvar buffer check without the mutex
+static int condvar_has_space(void * arg)
+{
+  return get_cnt(prodc) - get_cnt(conc) < BOUNDED_BUFFER_SIZE;
+}
+
+static int condvar_has_data(void * arg)
+{
+  return get_cnt(prodc) != get_cnt(conc) || get_cnt(conc) >= NUMBER_OF_MATRICES;
+}
+
+// Adaptive wait for the condvar buffer: drop the mutex, spin, yield and
+// finally park on lot until ready() holds, then take the mutex back
+static void condvar_park(ParkLot * lot, int (*ready)(void *))
+{
+  pthread_mutex_unlock(&mutex);
+  int ended = park_wait(lot, ready, NULL);
+  INSTR_ADD(waits_ended[ended], 1);
+  (void) ended; // only counted when instrumented
+  pthread_mutex_lock(&mutex);
+}
+
+// Tell threads waiting on the condvar buffer that n matrices arrived or left
+// Adaptive waiters are woken only as many as there are matrices or slots for
+static void condvar_wake(pthread_cond_t * cv, ParkLot * lot, int n)
+{
+  if (WAIT_MODE == WAIT_ADAPTIVE)
+    park_wake(lot, n);
+  else if (n > 1)
+    pthread_cond_broadcast(cv); // once per batch
+  else
+    pthread_cond_signal(cv);
+}
+
+// Condvar buffer: put n matrices, waiting whenever the buffer is full
+static void condvar_publish(Matrix ** values, int n)
+{
+  int done = 0;
+  pthread_mutex_lock(&mutex); // lock the mutex before accessing the buffer
+  INSTR_SECTION(section);
+  while (done < n) {
+    // wait while buffer is full
+    while (get_cnt(prodc) - get_cnt(conc) >= BOUNDED_BUFFER_SIZE) { // check if produced matrices - consumed matrices >= buffer size
+      add_cnt(&prodgate.waiting, 1);
+      if (WAIT_MODE == WAIT_ADAPTIVE)
+        INSTR_PARK(section, condvar_park(&space_lot, condvar_has_space), wait_empty_ns);
+      else
+        INSTR_WAIT(section, &empty, &mutex, wait_empty_ns); // wait until signaled that buffer has space
+      add_cnt(&prodgate.waiting, -1);
+    }
+    INSTR_WAITED(section);
+    INSTR_OCCUPANCY(get_cnt(prodc) - get_cnt(conc));
+    int room = BOUNDED_BUFFER_SIZE - (get_cnt(prodc) - get_cnt(conc)); // free slots
+    int k = n - done < room ? n - done : room;
+    put_many(values + done, k); // put as much of the batch as fits
+    done += k;
+    condvar_wake(&full, &data_lot, k); // signal that buffer has data
+  }
+  INSTR_END_SECTION(section);
+  pthread_mutex_unlock(&mutex); // unlock the mutex after accessing the buffer
+}
+
+// Condvar buffer: get up to max matrices, waiting while the buffer is empty
+// Returns the number taken, 0 once all matrices have been consumed
+static int condvar_fetch(Matrix ** values, int max)
+{
+  pthread_mutex_lock(&mutex); // lock the mutex before accessing the buffer
+  INSTR_SECTION(section);
+
+  // wait while the buffer is empty and the work is not done
+  while (get_cnt(prodc) == get_cnt(conc) && get_cnt(conc) < NUMBER_OF_MATRICES) {
+    add_cnt(&consgate.waiting, 1);
+    if (WAIT_MODE == WAIT_ADAPTIVE)
+      INSTR_PARK(section, condvar_park(&data_lot, condvar_has_data), wait_full_ns);
+    else
+      INSTR_WAIT(section, &full, &mutex, wait_full_ns);
+    add_cnt(&consgate.waiting, -1);
+  }
+  INSTR_WAITED(section);
+
+  // After waking, check if we've consumed all matrices
+  if (get_cnt(conc) >= NUMBER_OF_MATRICES) {
+    if (WAIT_MODE != WAIT_ADAPTIVE)
+      pthread_cond_broadcast(&full);  // Wake up other waiting consumers
+    INSTR_END_SECTION(section);
+    pthread_mutex_unlock(&mutex);
+    return 0;
+  }
+
+  // If we reach here, buffer must have data
+  INSTR_OCCUPANCY(get_cnt(prodc) - get_cnt(conc));
+  int avail = get_cnt(prodc) - get_cnt(conc);
+  int k = get_many(values, avail < max ? avail : max);
+  condvar_wake(&empty, &space_lot, k); // signal that buffer has space
+  if (WAIT_MODE == WAIT_ADAPTIVE && get_cnt(conc) >= NUMBER_OF_MATRICES)
+    park_wake(&data_lot, INT_MAX); // we took the last matrices, every waiting consumer can exit
+  INSTR_END_SECTION(section);
+  pthread_mutex_unlock(&mutex); // unlock the mutex
+  return k;
+}
+
+// Ring buffer: a consumer first reserves up to max of the NUMBER_OF_MATRICES
+// matrices by adding to conc, then waits on the ring only for the matrices
+// it actually holds a reservation for, so exactly NUMBER_OF_MATRICES
+// matrices are consumed without a global lock
+static int ring_fetch(Matrix ** values, int max)
+{
+  int claimed = fetch_add_cnt(conc, max);
+  if (claimed >= NUMBER_OF_MATRICES)
+    return 0; // all matrices already claimed by consumers
+  int k = NUMBER_OF_MATRICES - claimed < max ? NUMBER_OF_MATRICES - claimed : max;
+  INSTR_OCCUPANCY(ring_count(bigring));
+  ring_get_many(bigring, values, k);
+  return k;
+}
+
+// Work-stealing queues: reserve matrices exactly as ring_fetch() does, then
+// take them from our home queue or steal them from the other producers' queues
+static int steal_fetch(Matrix ** values, int max)
+{
+  int claimed = fetch_add_cnt(conc, max);
+  if (claimed >= NUMBER_OF_MATRICES)
+    return 0; // all matrices already claimed by consumers
+  int k = NUMBER_OF_MATRICES - claimed < max ? NUMBER_OF_MATRICES - claimed : max;
+  INSTR_OCCUPANCY(steal_count(bigsteal));
+  steal_get_many(bigsteal, home, values, k);
+  return k;
+}
+
+// Lanes: reserve matrices exactly as ring_fetch() does, then take them from
+// our consumer group's lane, or from the other lane while ours is empty
+static int lanes_fetch(Matrix ** values, int max)
+{
+  int claimed = fetch_add_cnt(conc, max);
+  if (claimed >= NUMBER_OF_MATRICES)
+    return 0; // all matrices already claimed by consumers
+  int k = NUMBER_OF_MATRICES - claimed < max ? NUMBER_OF_MATRICES - claimed : max;
+  lanes_get_many(biglanes, lanes_of_consumer(home, consgate.total, LANE_SHARE), values, k);
+  return k;
+}
+
+// Matching buffer: put n matrices into the shape index, waiting whenever it is full
+// Consumers waiting for a partner are woken on every batch, and before we
+// sleep on a full buffer so they can give up their matrix instead
+static void match_publish(Matrix ** values, int n)
+{
+  pthread_mutex_lock(&mutex); // lock the mutex before accessing the buffer
+  INSTR_SECTION(section);
+  for (int i = 0; i < n; i++) {
+    while (bigindex->count >= BOUNDED_BUFFER_SIZE) { // wait while buffer is full
+      pthread_cond_broadcast(&full); // consumers must hear about this batch before we sleep on it
+      pthread_cond_broadcast(&partner);
+      add_cnt(&prodgate.waiting, 1);
+      INSTR_WAIT(section, &empty, &mutex, wait_empty_ns);
+      add_cnt(&prodgate.waiting, -1);
+    }
+    INSTR_WAITED(section);
+    INSTR_OCCUPANCY(bigindex->count);
+    match_insert(bigindex, values[i]);
+    increment_cnt(prodc); // increment number of produced matrices
+  }
+  if (n > 1)
+    pthread_cond_broadcast(&full); // signal that buffer has data, once per batch
+  else
+    pthread_cond_signal(&full); // signal that buffer has data
+  pthread_cond_broadcast(&partner); // a waiting consumer's partner may have arrived
+  INSTR_END_SECTION(section);
+  pthread_mutex_unlock(&mutex); // unlock the mutex after accessing the buffer
+}
+
+// Matching buffer: get the oldest matrix, plus a matrix it can be
+// multiplied with if one is buffered and max allows it
+// Returns the number taken, 0 once all matrices have been consumed
+static int match_fetch(Matrix ** values, int max)
+{
+  pthread_mutex_lock(&mutex); // lock the mutex before accessing the buffer
+  INSTR_SECTION(section);
+
+  // wait while the buffer is empty and the work is not done
+  while (bigindex->count == 0 && get_cnt(conc) < NUMBER_OF_MATRICES) {
+    add_cnt(&consgate.waiting, 1);
+    INSTR_WAIT(section, &full, &mutex, wait_full_ns);
+    add_cnt(&consgate.waiting, -1);
+  }
+  INSTR_WAITED(section);
+
+  // After waking, check if we've consumed all matrices
+  if (get_cnt(conc) >= NUMBER_OF_MATRICES) {
+    pthread_cond_broadcast(&full);  // Wake up other waiting consumers
+    INSTR_END_SECTION(section);
+    pthread_mutex_unlock(&mutex);
+    return 0;
+  }
+
+  INSTR_OCCUPANCY(bigindex->count);
+  int k = 0;
+  values[k++] = match_take_oldest(bigindex);
+  if (max > 1 && (values[k] = match_take_rows(bigindex, values[0]->cols)) != NULL)
+    k++;
+  add_cnt(conc, k); // increment number of consumed matrices
+  if (k > 1)
+    pthread_cond_broadcast(&empty); // signal that buffer has space for both
+  else
+    pthread_cond_signal(&empty); // signal that buffer has space
+  INSTR_END_SECTION(section);
+  pthread_mutex_unlock(&mutex); // unlock the mutex
+  return k;
+}
+
+// Matching buffer: get a matrix that m1 can be multiplied with, waiting for one to arrive
+// Returns NULL when m1 should be given up: no partner is buffered and either
+// every matrix has been produced or the buffer is full, so waiting could deadlock
+static Matrix * match_fetch_partner(Matrix * m1)
+{
+  Matrix * value;
+  pthread_mutex_lock(&mutex); // lock the mutex before accessing the buffer
+  INSTR_SECTION(section);
+  while ((value = match_take_rows(bigindex, m1->cols)) == NULL) {
+    if (get_cnt(prodc) >= NUMBER_OF_MATRICES || bigindex->count >= BOUNDED_BUFFER_SIZE)
+      break;
+    add_cnt(&consgate.waiting, 1);
+    INSTR_WAIT(section, &partner, &mutex, wait_full_ns);
+    add_cnt(&consgate.waiting, -1);
+  }
+  INSTR_WAITED(section);
+  if (value != NULL) {
+    increment_cnt(conc); // increment number of consumed matrices
+    pthread_cond_signal(&empty); // signal that buffer has space
+  }
+  INSTR_END_SECTION(section);
+  pthread_mutex_unlock(&mutex); // unlock the mutex
+  return value;
+}
+
+// publish n produced matrices, blocking while the buffer is full
+void publish_matrices(Matrix ** values, int n)
+{
+  latency_enqueued(values, n);
+  if (PROCESSES)
+    procs_publish(values, n); // shared-memory buffer between processes
+  else if (BUFFER_MODE == BUFFER_MODE_RING)
+    ring_put_many(bigring, values, n);
+  else if (BUFFER_MODE == BUFFER_MODE_STEAL)
+    steal_put_many(bigsteal, home, values, n);
+  else if (BUFFER_MODE == BUFFER_MODE_LANES)
+    lanes_put_many(biglanes, values, n); // classed by size here
+  else if (BUFFER_MODE == BUFFER_MODE_MATCH)
+    match_publish(values, n);
+  else
+    condvar_publish(values, n);
+}
+
+// fetch up to max matrices, blocking while the buffer is empty
+// returns the number fetched, 0 once all NUMBER_OF_MATRICES matrices have been consumed
+int fetch_matrices(Matrix ** values, int max)
+{
+  if (PROCESSES)
+    return procs_fetch(values, max);
+  if (BUFFER_MODE == BUFFER_MODE_RING)
+    return ring_fetch(values, max);
+  if (BUFFER_MODE == BUFFER_MODE_STEAL)
+    return steal_fetch(values, max);
+  if (BUFFER_MODE == BUFFER_MODE_LANES)
+    return lanes_fetch(values, max);
+  if (BUFFER_MODE == BUFFER_MODE_MATCH)
+    return match_fetch(values, max);
+  return condvar_fetch(values, max);
+}
+
+// hand out the next matrix of a consumer's batch, fetching a new batch of
+// up to BATCH_SIZE when it runs out; NULL once all matrices have been consumed
+// In matching mode a batch is one matrix and, if one was buffered, its partner
+Matrix * next_matrix(MatrixBatch * batch)
+{
+  if (batch->next == batch->count) {
+    batch->count = fetch_matrices(batch->items, BUFFER_MODE == BUFFER_MODE_MATCH ? 2 : BATCH_SIZE);
+    batch->next = 0;
+    latency_dequeued(batch->items, batch->count);
+    if (batch->count == 0)
+      return NULL;
+  }
+  return batch->items[batch->next++];
+}
+
+// hand out the next candidate to multiply with m1
+// In matching mode this is a compatible matrix, either fetched together
+// with m1 or taken from the shape index, and NULL means m1 has to be given up.
+// Otherwise it is simply the next matrix, NULL once all have been consumed.
+Matrix * next_partner(MatrixBatch * batch, Matrix * m1)
+{
+  if (BUFFER_MODE != BUFFER_MODE_MATCH || batch->next < batch->count)
+    return next_matrix(batch);
+  Matrix * m2 = match_fetch_partner(m1);
+  if (m2 != NULL)
+    latency_dequeued(&m2, 1);
+  return m2;
+}
+
+// Produce and publish work_count matrices, BATCH_SIZE at a time
+static void produce(ProdConsStats * prods, int work_count)
+{
+  Matrix *produced[MAX_BATCH]; // batch of produced matrices
+
+  int i, j;
+  for (i = 0; i < work_count; i += BATCH_SIZE) {
+    int n = work_count - i < BATCH_SIZE ? work_count - i : BATCH_SIZE;
+    if (MATRIX_INPUT)
+      INSTR_TIME(generate_ns, input_next_many(produced, n)); // next recorded matrices, never short as NUMBER_OF_MATRICES <= input_count()
+    for (j = 0; j < n; j++) {
+      if (!MATRIX_INPUT)
+        INSTR_TIME(generate_ns, produced[j] = GenMatrixRandom()); // generate random matrix
+      latency_born(produced[j]);
+
+      INSTR_TIME(sum_ns, prods->sumtotal += SumMatrix(produced[j])); // Sum the matrix before putting it in buffer
+      prods->matrixtotal++; // increment produced matrix count
+    }
+
+    publish_matrices(produced, n); // put the whole batch into buffer
+  }
+}
+
 // Matrix PRODUCER worker thread
 void *prod_worker(void *arg)
 {
-  // Extract work count from argument
-  int *num_to_produce = (int*)arg; // cast argument to int pointer
-  int work_count = *num_to_produce; // dereference to get work count
-  free(num_to_produce);  // Free the allocated int
+  // Extract producer index and work count from argument
+  ProducerArgs *pargs = (ProducerArgs*)arg; // cast argument to producer arguments
+  int id = pargs->id; // producer index
+  int work_count = pargs->work; // number of matrices to produce
+  free(pargs);  // Free the allocated arguments
+  home = id; // producer i fills queue i
+  int pinned = affinity_apply(AFFINITY_PRODUCER, id) >= 0;
+  if (pinned && BUFFER_MODE == BUFFER_MODE_STEAL)
+    steal_attach(bigsteal, id); // keep our queue on our node
 
   // variable to hold progression stats
   ProdConsStats *prods = malloc(sizeof(ProdConsStats));
@@ -90,31 +443,80 @@ void *prod_worker(void *arg)
   prods->matrixtotal = 0; // matrixtotal - total number of matrces produced or consumed
   prods->multtotal = 0; // multtotal - total number of matrices multipled
 
-  Matrix *produced; // variable to hold produced matrix
+  if (ADAPTIVE) {
+    // Claim work a chunk at a time so a parked producer never strands its share
+    int chunk, n;
+    for (;;) {
+      adapt_wait(&prodgate, id);
+      if ((chunk = adapt_claim(&n)) < 0)
+        break;
+      MatrixSeedThread(RANDOM_SEED, chunk); // the chunk's reproducible random stream
+      produce(prods, n);
+    }
+  }
+  else {
+    MatrixSeedThread(RANDOM_SEED, id); // this producer's reproducible random stream
+    produce(prods, work_count);
+  }
 
-  int i;
-  // Produce matrices work_count times
-  for (i = 0; i < work_count; i++) {
-    produced = GenMatrixRandom(); // generate random matrix
+  MatrixPoolThreadFlush(); // hand cached free matrices back to the shared pool
+  instr_thread_flush(INSTR_PRODUCER);
+  return (void*) prods; // return progression stats
+}
 
-    prods->sumtotal += SumMatrix(produced); // Sum the matrix before putting it in buffer
-    prods->matrixtotal++; // increment produced matrix count
+// Consume every matrix in chains of up to CHAIN_LENGTH, each multiplied in
+// its cheapest order.  A candidate that does not fit onto the end of the
+// chain is discarded, as an incompatible second matrix is in pair mode;
+// a chain that gets no further than one matrix is discarded as well.
+static void consume_chains(ProdConsStats * cons, MatrixBatch * batch, OutputBuffer * out, int id)
+{
+  Chain * chain = chain_create();
+  for (;;) {
+    Matrix * last = chain->count > 0 ? chain->items[chain->count - 1] : NULL;
+    if (last == NULL && batch->next == batch->count)
+      adapt_wait(&consgate, id); // park here if asked to, never while holding matrices
+    Matrix * m = last == NULL ? next_matrix(batch) : next_partner(batch, last);
+    if (m == NULL && last == NULL)
+      break; // all matrices consumed
+    if (m != NULL) {
+      cons->matrixtotal++;
+      INSTR_TIME(sum_ns, cons->sumtotal += SumMatrix(m));
+      if (!chain_add(chain, m)) {
+        add_shcnt(discardc, id, 1);
+        FreeMatrix(m); // cannot extend the chain
+        continue;
+      }
+      if (chain->count < CHAIN_LENGTH)
+        continue;
+    }
 
-    pthread_mutex_lock(&mutex); // lock the mutex before accessing the buffer
-    // wait while buffer is full
-    while (get_cnt(prodc) - get_cnt(conc) >= BOUNDED_BUFFER_SIZE) // check if produced matrices - consumed matrices >= buffer size
-        pthread_cond_wait(&empty, &mutex); // wait until signaled that buffer has space
-    put(produced); // put produced matrix into buffer
-    pthread_cond_signal(&full); // signal that buffer has data
-    pthread_mutex_unlock(&mutex); // unlock the mutex after accessing the buffer
+    // the chain is full, or nothing more can be added to it
+    if (chain->count < 2) {
+      add_shcnt(discardc, id, 1);
+      chain_clear(chain);
+      continue;
+    }
+    Matrix * product;
+    INSTR_TIME(multiply_ns, product = chain_multiply(chain));
+    output_chain(out, chain->items, chain->count, product);
+    latency_done(chain->items, chain->count);
+    chain_clear(chain);
+    FreeMatrix(product);
+    cons->multtotal++;
   }
-
-  return (void*) prods; // return progression stats
+  chain_destroy(chain);
 }
 
 // Matrix CONSUMER worker thread
 void *cons_worker(void *arg)
 {
+  // Extract consumer index from argument
+  int *consumer_id = (int*)arg;
+  int id = *consumer_id; // index of this consumer's shard in discardc
+  free(consumer_id);
+  home = id; // consumer i starts with queue i % producers, or serves lanes_of_consumer(i)
+  affinity_apply(AFFINITY_CONSUMER, id); // next to producer i when pinned by policy
+
   // variable to hold progression stats
   ProdConsStats *cons = malloc(sizeof(ProdConsStats));
   cons->sumtotal = 0;
@@ -123,87 +525,59 @@ void *cons_worker(void *arg)
   
   // m1,m2: maxtrices to multiply; m3: result matrix
   Matrix *m1, *m2, *m3;
+  MatrixBatch batch = { .count = 0, .next = 0 }; // matrices fetched but not yet used
+  OutputBuffer out; // results formatted by this consumer, written by the writer thread
+  output_init(&out);
+  PairBatch *pairs = pairbatch_create(PAIR_BATCH); // tiny pairs waiting to be multiplied together
   
-  // Continue until all matrices consumed
-  while (1) {
-      pthread_mutex_lock(&mutex); // lock the mutex before accessing the buffer
-
-      // Check if we've consumed all matrices
-      if (get_cnt(conc) >= NUMBER_OF_MATRICES) {
-          // Wakes other consumers, unlocks mutex, returns stats
-          return cleanup_and_exit_consumer(NULL, cons);
-      }
-
-      // Wait for buffer data or exit if all work is done
-      void* result = wait_for_buffer_or_exit(NULL, cons);
-      if (result != NULL) {
-          return result;
-      }
-
-      // If we reach here, buffer must have data
-      m1 = get(); // get first matrix
-      pthread_cond_signal(&empty); // signal that buffer has space
-      pthread_mutex_unlock(&mutex); // unlock the mutex
-      
-      cons->matrixtotal++; // increment consumed matrix count
-      cons->sumtotal += SumMatrix(m1); // sum the matrix
-      
-      pthread_mutex_lock(&mutex); // lock the mutex before accessing the buffer
-
-      // If we've consumed all matrices, wakes other consumers, unlocks mutex, frees m1, returns stats
-      if (get_cnt(conc) >= NUMBER_OF_MATRICES) {
-          return cleanup_and_exit_consumer(m1, cons);
-      }
+  if (CHAIN_LENGTH)
+    consume_chains(cons, &batch, &out, id); // leaves nothing for the loop below
 
-      // Wait for buffer data or exit if all work is done
-      result = wait_for_buffer_or_exit(m1, cons);
-      if (result != NULL) {
-          return result;
+  // Continue until all matrices consumed
+  for (;;) {
+      if (batch.next == batch.count) {
+        if (adapt_parking(&consgate, id))
+          pairbatch_flush(pairs, &out); // multiply the pending pairs rather than park with them
+        adapt_wait(&consgate, id); // park here if asked to, never while holding matrices
       }
-
-      // If we reach here, buffer must have data
-      m2 = get();
-      pthread_cond_signal(&empty); // signal that buffer has space
-      pthread_mutex_unlock(&mutex); // unlock the mutex
-
+      if ((m1 = next_matrix(&batch)) == NULL) // get first matrix
+        break;
       cons->matrixtotal++; // increment consumed matrix count
-      cons->sumtotal += SumMatrix(m2); // sum the matrix
+      INSTR_TIME(sum_ns, cons->sumtotal += SumMatrix(m1)); // sum the matrix
 
-      m3 = MatrixMultiply(m1, m2); // multiply matrices
-      
-      while (m3 == NULL) { // while multiplication failed (incompatible sizes)
-        FreeMatrix(m2); // free second matrix
-
-        pthread_mutex_lock(&mutex); // lock the mutex before accessing the buffer
-
-        // Check if all possible matrices have been consumed and we need to stop
-        if (get_cnt(conc) >= NUMBER_OF_MATRICES) {
-          return cleanup_and_exit_consumer(m1, cons);
-        }
-
-        // Wait for buffer data or exit if all work is done
-        result = wait_for_buffer_or_exit(m1, cons);
-        if (result != NULL) {
-          return result;
+      // keep pulling matrices until one can be multiplied with m1
+      m3 = NULL;
+      while (m3 == NULL) {
+        m2 = next_partner(&batch, m1);
+        if (m2 == NULL) { // no partner for m1
+          add_shcnt(discardc, id, 1);
+          FreeMatrix(m1);
+          break;
         }
 
-        // If we reach here, buffer must have data
-        m2 = get();
-        pthread_cond_signal(&empty); // signal that buffer has space
-        pthread_mutex_unlock(&mutex); // unlock the mutex
-
         cons->matrixtotal++; // increase the tracker for total number of matrices consumed by 1
-        cons->sumtotal += SumMatrix(m2); // increase the tracker for total sum of all consumed by sum of the matrix
-        m3 = MatrixMultiply(m1, m2); // multiply the matrices together, will return NULL if incompatible
+        INSTR_TIME(sum_ns, cons->sumtotal += SumMatrix(m2)); // increase the tracker for total sum of all consumed by sum of the matrix
+        if ((m3 = prodcache_lookup(m1, m2)) != NULL) // multiplied before
+          break;
+        if (pairbatch_add(pairs, m1, m2, &out)) { // tiny pair, multiplied with others of its shape
+          cons->multtotal++;
+          break;
+        }
+        INSTR_TIME(multiply_ns, m3 = MatrixMultiply(m1, m2)); // multiply the matrices together, will return NULL if incompatible
+        if (m3 != NULL)
+          prodcache_insert(m1, m2, m3);
+        if (m3 == NULL) {
+          add_shcnt(discardc, id, 1);
+          FreeMatrix(m2); // free second matrix (incompatible sizes)
+        }
       }
+      if (m3 == NULL)
+        continue; // m1 was given up or batched, start over with a new first matrix
       
       // Print the multiplication result
-      DisplayMatrix(m1, stdout);
-      printf("    X\n");
-      DisplayMatrix(m2, stdout);
-      printf("    =\n");
-      DisplayMatrix(m3, stdout);
-      printf("\n");
+      output_result(&out, m1, m2, m3);
+      Matrix * pair[2] = { m1, m2 };
+      latency_done(pair, 2);
       
       // Free matrices
       FreeMatrix(m1);
@@ -212,8 +586,14 @@ void *cons_worker(void *arg)
       
       // increase total successfully multiplied tracker by 1
       cons->multtotal++;
-      
   }
   
+  adapt_open(&consgate); // nothing left, parked consumers can exit
+  pairbatch_flush(pairs, &out); // multiply the batches that never filled up
+  pairbatch_destroy(pairs);
+  output_flush(&out); // hand the last results to the writer thread
+  MatrixPoolThreadFlush(); // hand cached free matrices back to the shared pool
+  instr_thread_flush(INSTR_CONSUMER);
+  latency_thread_flush();
   return (void*) cons; // return progression stats
 }
@@ -7,8 +7,13 @@
  */
 
 Matrix ** bigmatrix;
+Ring * bigring;
+StealQueues * bigsteal;
+MatchIndex * bigindex;
+Lanes * biglanes;
 counter_t *prodc;
 counter_t *conc; 
+sharded_counter_t *discardc; // matrices consumed without being multiplied, one shard per consumer
 
 // PRODUCER-CONSUMER put() get() function prototypes
 
@@ -17,15 +22,59 @@ counter_t *conc;
 // multtotal - total number of matrices multipled
 // matrixtotal - total number of matrces produced or consumed
 typedef struct prodcons {
-  int sumtotal;
-  int multtotal;
-  int matrixtotal;
+  long sumtotal;
+  long multtotal;
+  long matrixtotal;
 } ProdConsStats;
 
+// Totals of one run, aggregated from every worker's ProdConsStats
+typedef struct run_totals {
+  long produced;
+  long consumed;
+  long prodsum;
+  long conssum;
+  long multiplied;
+  long discarded; // matrices consumed without a multiplication partner
+  long routed_large; // lanes mode: matrices routed to the large lane
+  long spilled; // lanes mode: matrices taken by a consumer of the other lane
+  int failed; // process mode: worker processes that died, the totals are partial
+  AdaptStats adapt; // how the pools were scaled
+} RunTotals;
+
+// Run the whole pipeline once with the current settings (pcmatrix.c)
+void run_pipeline(int nprod, int ncons, int output_fd, RunTotals *totals);
+
+// Arguments handed to each producer thread
+// id   - producer index, selects the producer's random stream
+// work - number of matrices to produce, unused when ADAPTIVE claims work in chunks
+typedef struct producer_args {
+  int id;
+  int work;
+} ProducerArgs;
+
+// Matrices a consumer fetched in one batch and hands out one at a time
+// items - fetched matrices
+// count - number of matrices fetched
+// next  - index of the next matrix to hand out
+typedef struct matrix_batch {
+  Matrix * items[MAX_BATCH];
+  int count;
+  int next;
+} MatrixBatch;
+
 // PRODUCER-CONSUMER thread method function prototypes
 void *prod_worker(void *arg);
 void *cons_worker(void *arg);
 
 // Routines to add and remove matrices from the bounded buffer
+void reset_buffer();
 int put(Matrix *value);
 Matrix * get();
+int put_many(Matrix **values, int n);
+int get_many(Matrix **values, int n);
+
+// Blocking routines used by the workers, dispatch on BUFFER_MODE
+void publish_matrices(Matrix **values, int n);
+int fetch_matrices(Matrix **values, int max);
+Matrix * next_matrix(MatrixBatch *batch);
+Matrix * next_partner(MatrixBatch *batch, Matrix *m1);
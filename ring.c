@@ -0,0 +1,257 @@
+/*
+ *  ring module
+ *  Lock-free bounded multi-producer/multi-consumer ring buffer
+ *
+ *  Each slot carries a sequence number.  A producer may fill slot pos
+ *  when seq == pos, a consumer may use it when seq == pos + 1.  Claiming
+ *  a slot is a single CAS on head (producers) or tail (consumers), so
+ *  threads only ever block when the ring is truly full or empty.
+ *
+ *  Based on Dmitry Vyukov's bounded MPMC queue
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Include only libraries for this module
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <assert.h>
+#include <pthread.h>
+#include "element.h"
+#include "matrix.h"
+#include "ring.h"
+#include "instrument.h"
+
+// Hint to the CPU that we are busy waiting
+static inline void ring_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+Ring * ring_create(int capacity)
+{
+  assert(capacity > 0);
+  // With a single slot "filled" (seq == pos + 1) and "free for the next
+  // lap" (seq == pos + capacity) are indistinguishable, so use at least two
+  if (capacity < 2)
+    capacity = 2;
+  Ring * r = (Ring *) aligned_alloc(CACHE_LINE_SIZE, sizeof(Ring));
+  assert(r != 0);
+  r->slots = (RingSlot *) aligned_alloc(CACHE_LINE_SIZE, sizeof(RingSlot) * capacity);
+  assert(r->slots != 0);
+  for (int i = 0; i < capacity; i++) {
+    atomic_init(&r->slots[i].seq, (size_t) i); // slot i is free for the producer holding ticket i
+    r->slots[i].value = NULL;
+  }
+  r->capacity = capacity;
+  atomic_init(&r->head, 0);
+  atomic_init(&r->tail, 0);
+  atomic_init(&r->waiting_producers, 0);
+  atomic_init(&r->waiting_consumers, 0);
+  pthread_mutex_init(&r->lock, NULL);
+  pthread_cond_init(&r->notfull, NULL);
+  pthread_cond_init(&r->notempty, NULL);
+  return r;
+}
+
+void ring_destroy(Ring * r)
+{
+  pthread_mutex_destroy(&r->lock);
+  pthread_cond_destroy(&r->notfull);
+  pthread_cond_destroy(&r->notempty);
+  free(r->slots);
+  free(r);
+}
+
+// Try to put a matrix into the ring, returns 0 if the ring is full
+int ring_try_put(Ring * r, Matrix * value)
+{
+  RingSlot * slot;
+  size_t pos = atomic_load_explicit(&r->head, memory_order_relaxed);
+  for (;;) {
+    slot = &r->slots[pos % r->capacity];
+    size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    intptr_t dif = (intptr_t) seq - (intptr_t) pos;
+    if (dif == 0) {
+      // slot is free, try to claim it
+      if (atomic_compare_exchange_weak_explicit(&r->head, &pos, pos + 1,
+                                                memory_order_relaxed, memory_order_relaxed))
+        break;
+    }
+    else if (dif < 0)
+      return 0; // slot still holds an unconsumed matrix, ring is full
+    else
+      pos = atomic_load_explicit(&r->head, memory_order_relaxed); // another producer got there first
+  }
+  slot->value = value;
+  atomic_store_explicit(&slot->seq, pos + 1, memory_order_release); // hand the slot to consumers
+  return 1;
+}
+
+// Try to get a matrix from the ring, returns NULL if the ring is empty
+Matrix * ring_try_get(Ring * r)
+{
+  RingSlot * slot;
+  size_t pos = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  for (;;) {
+    slot = &r->slots[pos % r->capacity];
+    size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    intptr_t dif = (intptr_t) seq - (intptr_t) (pos + 1);
+    if (dif == 0) {
+      // slot is filled, try to claim it
+      if (atomic_compare_exchange_weak_explicit(&r->tail, &pos, pos + 1,
+                                                memory_order_relaxed, memory_order_relaxed))
+        break;
+    }
+    else if (dif < 0)
+      return NULL; // slot not yet filled, ring is empty
+    else
+      pos = atomic_load_explicit(&r->tail, memory_order_relaxed); // another consumer got there first
+  }
+  Matrix * value = slot->value;
+  atomic_store_explicit(&slot->seq, pos + r->capacity, memory_order_release); // hand the slot back to producers
+  return value;
+}
+
+// Checks used by parked threads, must match the tests in ring_try_put() / ring_try_get()
+static int ring_has_space(Ring * r)
+{
+  size_t pos = atomic_load(&r->head);
+  size_t seq = atomic_load(&r->slots[pos % r->capacity].seq);
+  return (intptr_t) seq - (intptr_t) pos >= 0;
+}
+
+static int ring_has_data(Ring * r)
+{
+  size_t pos = atomic_load(&r->tail);
+  size_t seq = atomic_load(&r->slots[pos % r->capacity].seq);
+  return (intptr_t) seq - (intptr_t) (pos + 1) >= 0;
+}
+
+// Park the calling thread on cv until ready() holds
+// The waiter count is published before the condition is rechecked so a
+// thread that changes the ring and then reads the count cannot miss us
+static void ring_park(Ring * r, _Atomic int * waiters, pthread_cond_t * cv, int (*ready)(Ring *))
+{
+  atomic_fetch_add(waiters, 1);
+  atomic_thread_fence(memory_order_seq_cst);
+  pthread_mutex_lock(&r->lock);
+  while (!ready(r))
+    pthread_cond_wait(cv, &r->lock);
+  pthread_mutex_unlock(&r->lock);
+  atomic_fetch_sub(waiters, 1);
+}
+
+// Wake parked threads after n items changed hands: one thread for a
+// single item, all of them for a batch
+static void ring_unpark(Ring * r, _Atomic int * waiters, pthread_cond_t * cv, int n)
+{
+  if (n <= 0)
+    return;
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(waiters, memory_order_relaxed) > 0) {
+    pthread_mutex_lock(&r->lock);
+    if (n > 1)
+      pthread_cond_broadcast(cv);
+    else
+      pthread_cond_signal(cv);
+    pthread_mutex_unlock(&r->lock);
+  }
+}
+
+// put n matrices into the ring, blocking while the ring is full
+// consumers are woken once for the whole batch, or early if we have to park
+void ring_put_many(Ring * r, Matrix ** values, int n)
+{
+  int done = 0;
+  int woken = 0; // items other threads have been told about
+  int spins = 0;
+  int parks = 0; // times parked waiting for the current item
+  while (done < n) {
+    if (ring_try_put(r, values[done])) {
+      done++;
+      spins = 0;
+      INSTR_ADD(futile_wakeups, parks > 1 ? parks - 1 : 0);
+      parks = 0;
+    }
+    else if (++spins < RING_SPIN_LIMIT)
+      ring_relax();
+    else {
+      ring_unpark(r, &r->waiting_consumers, &r->notempty, done - woken); // don't sleep on data nobody was told about
+      woken = done;
+      INSTR_TIME(wait_empty_ns, ring_park(r, &r->waiting_producers, &r->notfull, ring_has_space));
+      parks++;
+      spins = 0;
+    }
+  }
+  ring_unpark(r, &r->waiting_consumers, &r->notempty, n - woken); // ring has data
+}
+
+// get n matrices from the ring, blocking while the ring is empty
+// producers are woken once for the whole batch, or early if we have to park
+void ring_get_many(Ring * r, Matrix ** values, int n)
+{
+  int done = 0;
+  int woken = 0; // items other threads have been told about
+  int spins = 0;
+  int parks = 0; // times parked waiting for the current item
+  while (done < n) {
+    if ((values[done] = ring_try_get(r)) != NULL) {
+      done++;
+      spins = 0;
+      INSTR_ADD(futile_wakeups, parks > 1 ? parks - 1 : 0);
+      parks = 0;
+    }
+    else if (++spins < RING_SPIN_LIMIT)
+      ring_relax();
+    else {
+      ring_unpark(r, &r->waiting_producers, &r->notfull, done - woken); // don't sleep on space nobody was told about
+      woken = done;
+      INSTR_TIME(wait_full_ns, ring_park(r, &r->waiting_consumers, &r->notempty, ring_has_data));
+      parks++;
+      spins = 0;
+    }
+  }
+  ring_unpark(r, &r->waiting_producers, &r->notfull, n - woken); // ring has space
+}
+
+// get between 1 and max matrices from the ring, blocking only while it is empty
+// returns the number taken
+int ring_get_some(Ring * r, Matrix ** values, int max)
+{
+  ring_get_many(r, values, 1);
+  int n = 1;
+  while (n < max && (values[n] = ring_try_get(r)) != NULL)
+    n++;
+  ring_unpark(r, &r->waiting_producers, &r->notfull, n - 1); // ring has space
+  return n;
+}
+
+// put a matrix into the ring, blocking while the ring is full
+void ring_put(Ring * r, Matrix * value)
+{
+  ring_put_many(r, &value, 1);
+}
+
+// get a matrix from the ring, blocking while the ring is empty
+Matrix * ring_get(Ring * r)
+{
+  Matrix * value;
+  ring_get_many(r, &value, 1);
+  return value;
+}
+
+// approximate number of matrices in the ring, exact only when no thread is mid-operation
+int ring_count(Ring * r)
+{
+  size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  return head > tail ? (int) (head - tail) : 0;
+}
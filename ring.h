@@ -0,0 +1,52 @@
+/*
+ *  ring header
+ *  Function prototypes, data, and constants for the lock-free ring buffer module
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// LOCK-FREE MPMC RING BUFFER
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+// Number of failed attempts a thread spins on the ring before parking
+#define RING_SPIN_LIMIT 128
+
+// A single ring slot
+// seq   - sequence number telling producers/consumers whose turn the slot is
+// value - matrix stored in the slot
+typedef struct ring_slot {
+  _Atomic size_t seq;
+  Matrix * value;
+} __attribute__((aligned(CACHE_LINE_SIZE))) RingSlot;
+
+// Bounded multi-producer/multi-consumer ring
+// head and tail are kept on their own cache lines so producers and
+// consumers do not false-share; the parking lot is only touched when
+// the ring is actually full or empty
+typedef struct ring {
+  _Atomic size_t head __attribute__((aligned(CACHE_LINE_SIZE))); // next slot to fill
+  _Atomic size_t tail __attribute__((aligned(CACHE_LINE_SIZE))); // next slot to use
+  size_t capacity __attribute__((aligned(CACHE_LINE_SIZE)));
+  RingSlot * slots;
+  _Atomic int waiting_producers; // producers parked on notfull
+  _Atomic int waiting_consumers; // consumers parked on notempty
+  pthread_mutex_t lock;
+  pthread_cond_t notfull;
+  pthread_cond_t notempty;
+} Ring;
+
+// ring methods
+Ring * ring_create(int capacity);
+void ring_destroy(Ring * r);
+int ring_try_put(Ring * r, Matrix * value);
+Matrix * ring_try_get(Ring * r);
+void ring_put(Ring * r, Matrix * value);
+Matrix * ring_get(Ring * r);
+void ring_put_many(Ring * r, Matrix ** values, int n);
+void ring_get_many(Ring * r, Matrix ** values, int n);
+int ring_get_some(Ring * r, Matrix ** values, int max);
+int ring_count(Ring * r);
@@ -0,0 +1,304 @@
+/*
+ *  stages module
+ *  Staged pipeline engine
+ *
+ *  In the producer/consumer pipeline a consumer sums, pairs, multiplies,
+ *  formats and frees every matrix it takes.  Here each of those steps is
+ *  a stage with its own worker threads and its own bounded queue:
+ *
+ *    generate -> checksum -> pair -> multiply -> output
+ *
+ *  so an expensive stage can be given more threads, and formatting and
+ *  writing results overlaps with the multiplies instead of waiting for
+ *  them.  The queues are lock-free rings; a pair or a triple is passed
+ *  on as its first matrix with the others linked through next, so nothing
+ *  is allocated between stages.
+ *
+ *  When the last worker of a stage finishes it puts one end marker per
+ *  worker of the next stage behind everything it and its peers queued.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "counter.h"
+#include "element.h"
+#include "matrix.h"
+#include "ring.h"
+#include "steal.h"
+#include "match.h"
+#include "lanes.h"
+#include "output.h"
+#include "bench.h"
+#include "instrument.h"
+#include "adapt.h"
+#include "mulpool.h"
+#include "input.h"
+#include "latency.h"
+#include "prodcache.h"
+#include "pcmatrix.h"
+#include "prodcons.h"
+#include "stages.h"
+
+static Stage stages[STAGE_COUNT] = {
+  { "generate", 1 }, { "checksum", 1 }, { "pair", 1 }, { "multiply", 1 }, { "output", 1 }
+};
+
+static Matrix stage_end; // end of stream marker, never dereferenced
+static __thread int stage_ended; // the calling worker has taken its end marker
+
+// Run totals, updated once per worker
+static _Atomic long produced, consumed, prodsum, conssum, multiplied, discarded;
+
+// Parse --stages=G,C,P,M,O, the worker count of every stage
+// Returns 0, -1 if the list is malformed
+int stages_parse(const char * arg)
+{
+  int counts[STAGE_COUNT];
+  if (bench_parse_list(arg, counts, STAGE_COUNT, bench_parse_int) != STAGE_COUNT)
+    return -1;
+  for (int s = 0; s < STAGE_COUNT; s++)
+    if (counts[s] < 1)
+      return -1; // every stage needs a worker
+  for (int s = 0; s < STAGE_COUNT; s++)
+    stages[s].workers = counts[s];
+  return 0;
+}
+
+void stages_describe(FILE * stream)
+{
+  fprintf(stream, "Running a staged pipeline:");
+  for (int s = 0; s < STAGE_COUNT; s++)
+    fprintf(stream, " %s=%d", stages[s].name, stages[s].workers);
+  fprintf(stream, " worker(s).\n");
+}
+
+// Pass n items on to the next stage
+static void stage_put(int stage, Matrix ** items, int n)
+{
+  if (n > 0)
+    ring_put_many(stages[stage + 1].in, items, n);
+}
+
+// Take up to max items from a stage's queue, waiting for the first one
+// Returns the number taken, 0 once this worker has reached the end of the stream
+static int stage_get(int stage, Matrix ** items, int max)
+{
+  if (stage_ended)
+    return 0;
+  Ring * in = stages[stage].in;
+  int n = ring_get_some(in, items, max);
+  for (int i = 0; i < n; i++)
+    if (items[i] == &stage_end) {
+      stage_ended = 1; // this worker's end marker, the items before it are the last ones
+      if (i + 1 < n)
+        ring_put_many(in, items + i + 1, n - i - 1); // the markers behind ours belong to other workers
+      return i;
+    }
+  return n;
+}
+
+// Last worker of a stage out closes the next stage's queue
+static void stage_finish(int stage)
+{
+  if (atomic_fetch_sub(&stages[stage].running, 1) != 1 || stage + 1 == STAGE_COUNT)
+    return;
+  for (int i = 0; i < stages[stage + 1].workers; i++)
+    ring_put(stages[stage + 1].in, &stage_end);
+}
+
+// Generate worker id's share of the matrices, or replay them from the input files
+static void stage_generate(int id)
+{
+  int workers = stages[STAGE_GENERATE].workers;
+  int work = NUMBER_OF_MATRICES / workers + (id < NUMBER_OF_MATRICES % workers ? 1 : 0);
+  Matrix * items[MAX_BATCH];
+  long sum = 0;
+  MatrixSeedThread(RANDOM_SEED, id); // worker i draws from stream i, like producer i
+  for (int i = 0; i < work; i += BATCH_SIZE) {
+    int n = work - i < BATCH_SIZE ? work - i : BATCH_SIZE;
+    if (MATRIX_INPUT)
+      INSTR_TIME(generate_ns, input_next_many(items, n));
+    for (int j = 0; j < n; j++) {
+      if (!MATRIX_INPUT)
+        INSTR_TIME(generate_ns, items[j] = GenMatrixRandom());
+      latency_born(items[j]);
+      INSTR_TIME(sum_ns, sum += SumMatrix(items[j]));
+    }
+    latency_enqueued(items, n);
+    stage_put(STAGE_GENERATE, items, n);
+  }
+  atomic_fetch_add(&produced, work);
+  atomic_fetch_add(&prodsum, sum);
+}
+
+// Sum every matrix as it is consumed
+static void stage_checksum()
+{
+  Matrix * items[STAGE_MAX_BATCH];
+  long sum = 0, count = 0;
+  int n;
+  while ((n = stage_get(STAGE_CHECKSUM, items, BATCH_SIZE < STAGE_MAX_BATCH ? BATCH_SIZE : STAGE_MAX_BATCH)) > 0) {
+    latency_dequeued(items, n); // the queue a consumer would have taken them from
+    for (int i = 0; i < n; i++)
+      INSTR_TIME(sum_ns, sum += SumMatrix(items[i]));
+    count += n;
+    stage_put(STAGE_CHECKSUM, items, n);
+  }
+  atomic_fetch_add(&consumed, count);
+  atomic_fetch_add(&conssum, sum);
+}
+
+// Pair matrices the way a consumer does: hold a first matrix and discard
+// candidates until one can be multiplied with it
+static void stage_pair()
+{
+  Matrix * items[STAGE_MAX_BATCH];
+  Matrix * pairs[STAGE_MAX_BATCH];
+  Matrix * m1 = NULL;
+  long dropped = 0;
+  int n;
+  while ((n = stage_get(STAGE_PAIR, items, BATCH_SIZE < STAGE_MAX_BATCH ? BATCH_SIZE : STAGE_MAX_BATCH)) > 0) {
+    int npairs = 0;
+    for (int i = 0; i < n; i++) {
+      if (m1 == NULL)
+        m1 = items[i];
+      else if (m1->cols == items[i]->rows) {
+        m1->next = items[i]; // the pair travels as m1
+        items[i]->next = NULL;
+        pairs[npairs++] = m1;
+        m1 = NULL;
+      }
+      else {
+        dropped++;
+        FreeMatrix(items[i]); // incompatible sizes
+      }
+    }
+    stage_put(STAGE_PAIR, pairs, npairs);
+  }
+  if (m1 != NULL) { // no partner left for it
+    dropped++;
+    FreeMatrix(m1);
+  }
+  atomic_fetch_add(&discarded, dropped);
+}
+
+// Multiply every pair, the product is linked behind the second matrix
+static void stage_multiply()
+{
+  Matrix * items[STAGE_MAX_BATCH];
+  int n;
+  while ((n = stage_get(STAGE_MULTIPLY, items, BATCH_SIZE < STAGE_MAX_BATCH ? BATCH_SIZE : STAGE_MAX_BATCH)) > 0) {
+    for (int i = 0; i < n; i++) {
+      Matrix * m2 = items[i]->next;
+      INSTR_TIME(multiply_ns, m2->next = prodcache_multiply(items[i], m2));
+    }
+    stage_put(STAGE_MULTIPLY, items, n);
+  }
+}
+
+// Format and free every result
+static void stage_output()
+{
+  Matrix * items[STAGE_MAX_BATCH];
+  OutputBuffer out;
+  long count = 0;
+  int n;
+  output_init(&out);
+  while ((n = stage_get(STAGE_OUTPUT, items, BATCH_SIZE < STAGE_MAX_BATCH ? BATCH_SIZE : STAGE_MAX_BATCH)) > 0) {
+    for (int i = 0; i < n; i++) {
+      Matrix * m1 = items[i], * m2 = m1->next, * m3 = m2->next;
+      output_result(&out, m1, m2, m3);
+      Matrix * pair[2] = { m1, m2 };
+      latency_done(pair, 2);
+      FreeMatrix(m1);
+      FreeMatrix(m2);
+      FreeMatrix(m3);
+    }
+    count += n;
+  }
+  output_flush(&out);
+  atomic_fetch_add(&multiplied, count);
+}
+
+static void *stage_worker(void *arg)
+{
+  StageArgs * sargs = (StageArgs *) arg;
+  int stage = sargs->stage;
+  int id = sargs->id;
+  free(sargs);
+  switch (stage) {
+    case STAGE_GENERATE: stage_generate(id); break;
+    case STAGE_CHECKSUM: stage_checksum(); break;
+    case STAGE_PAIR: stage_pair(); break;
+    case STAGE_MULTIPLY: stage_multiply(); break;
+    case STAGE_OUTPUT: stage_output(); break;
+  }
+  stage_finish(stage);
+  MatrixPoolThreadFlush(); // hand cached free matrices back to the shared pool
+  instr_thread_flush(stage == STAGE_GENERATE ? INSTR_PRODUCER : INSTR_CONSUMER);
+  latency_thread_flush();
+  return NULL;
+}
+
+// Run every stage once with the current settings and aggregate the totals
+// Results go to output_fd unless RESULT_OUTPUT is quiet
+void stages_run(int output_fd, RunTotals * totals)
+{
+  if (MATRIX_INPUT)
+    input_rewind(); // every run replays the input from the start
+  instr_reset();
+  produced = consumed = prodsum = conssum = multiplied = discarded = 0;
+  int nthreads = 0;
+  for (int s = 0; s < STAGE_COUNT; s++) {
+    stages[s].in = s == STAGE_GENERATE ? NULL : ring_create(BOUNDED_BUFFER_SIZE);
+    atomic_store(&stages[s].running, stages[s].workers);
+    stages[s].threads = (pthread_t *) malloc(sizeof(pthread_t) * stages[s].workers);
+    nthreads += stages[s].workers;
+  }
+
+  fflush(stdout); // everything printed so far must come out before the results
+  if (RESULT_OUTPUT != RESULT_QUIET)
+    output_start(output_fd, stages[STAGE_OUTPUT].workers);
+  mulpool_start(MUL_THREADS, nthreads);
+
+  // start the stages from the end, so every queue already has its readers
+  for (int s = STAGE_COUNT - 1; s >= 0; s--)
+    for (int i = 0; i < stages[s].workers; i++) {
+      StageArgs * sargs = (StageArgs *) malloc(sizeof(StageArgs));
+      sargs->stage = s;
+      sargs->id = i;
+      pthread_create(&stages[s].threads[i], NULL, stage_worker, sargs);
+    }
+  for (int s = 0; s < STAGE_COUNT; s++)
+    for (int i = 0; i < stages[s].workers; i++)
+      pthread_join(stages[s].threads[i], NULL);
+
+  output_stop();
+  mulpool_stop();
+
+  totals->produced = produced;
+  totals->consumed = consumed;
+  totals->prodsum = prodsum;
+  totals->conssum = conssum;
+  totals->multiplied = multiplied;
+  totals->discarded = discarded;
+  totals->routed_large = totals->spilled = 0;
+  totals->failed = 0;
+  memset(&totals->adapt, 0, sizeof(totals->adapt));
+  totals->adapt.producers = stages[STAGE_GENERATE].workers;
+  totals->adapt.consumers = nthreads - stages[STAGE_GENERATE].workers;
+  totals->adapt.mean_producers = totals->adapt.producers;
+  totals->adapt.mean_consumers = totals->adapt.consumers;
+
+  for (int s = 0; s < STAGE_COUNT; s++) {
+    if (stages[s].in != NULL)
+      ring_destroy(stages[s].in);
+    free(stages[s].threads);
+  }
+}
@@ -0,0 +1,42 @@
+/*
+ *  stages header
+ *  Function prototypes, data, and constants for the staged pipeline engine
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Pipeline stages, in the order matrices flow through them
+#define STAGE_GENERATE 0
+#define STAGE_CHECKSUM 1
+#define STAGE_PAIR 2
+#define STAGE_MULTIPLY 3
+#define STAGE_OUTPUT 4
+#define STAGE_COUNT 5
+
+// Most items a worker takes from its queue at once, see BATCH_SIZE
+#define STAGE_MAX_BATCH 64
+
+// One stage of the pipeline
+// workers - threads running the stage
+// running - workers not yet finished, the last one to finish closes the next queue
+// in      - bounded queue feeding the stage, NULL for generate
+// Pairs and triples travel as their first matrix, linked through next
+typedef struct stage {
+  const char * name;
+  int workers;
+  _Atomic int running;
+  Ring * in;
+  pthread_t * threads;
+} Stage;
+
+// Arguments handed to each stage worker
+typedef struct stage_args {
+  int stage;
+  int id; // index among the stage's workers
+} StageArgs;
+
+// stages methods
+int stages_parse(const char * arg);
+void stages_run(int output_fd, RunTotals * totals);
+void stages_describe(FILE * stream);
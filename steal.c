@@ -0,0 +1,266 @@
+/*
+ *  steal module
+ *  Per-producer queues with work stealing consumers
+ *
+ *  Every producer owns a bounded queue that only it appends to, so
+ *  producers never contend with each other.  A consumer takes from its
+ *  home queue and, when that is empty, steals from the others in turn.
+ *  Taking is a single CAS on the queue's top, and a consumer may take
+ *  several matrices with one CAS.  Matrices therefore tend to be used
+ *  by the consumer paired with the producer that built them, and there
+ *  is no one index every thread fights over.
+ *
+ *  Threads park, as in the ring module, only when their producer's queue
+ *  is full or every queue is empty.
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// Include only libraries for this module
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <assert.h>
+#include <pthread.h>
+#include "element.h"
+#include "matrix.h"
+#include "steal.h"
+#include "instrument.h"
+
+// Hint to the CPU that we are busy waiting
+static inline void steal_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+// Create nqueues queues sharing capacity slots between them, at least one each
+StealQueues * steal_create(int nqueues, int capacity)
+{
+  assert(nqueues > 0 && capacity >= nqueues);
+  StealQueues * s = (StealQueues *) malloc(sizeof(StealQueues));
+  assert(s != 0);
+  s->queues = (StealQueue *) aligned_alloc(CACHE_LINE_SIZE, sizeof(StealQueue) * nqueues);
+  assert(s->queues != 0);
+  s->nqueues = nqueues;
+  for (int i = 0; i < nqueues; i++) {
+    StealQueue * q = &s->queues[i];
+    // split the slots evenly, the first queues take the remainder
+    q->capacity = capacity / nqueues + (i < capacity % nqueues ? 1 : 0);
+    q->items = (Matrix **) malloc(sizeof(Matrix *) * q->capacity);
+    assert(q->items != 0);
+    atomic_init(&q->top, 0);
+    atomic_init(&q->bottom, 0);
+    atomic_init(&q->waiting, 0);
+    pthread_cond_init(&q->notfull, NULL);
+  }
+  atomic_init(&s->waiting_consumers, 0);
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->notempty, NULL);
+  return s;
+}
+
+void steal_destroy(StealQueues * s)
+{
+  for (int i = 0; i < s->nqueues; i++) {
+    pthread_cond_destroy(&s->queues[i].notfull);
+    free(s->queues[i].items);
+  }
+  pthread_mutex_destroy(&s->lock);
+  pthread_cond_destroy(&s->notempty);
+  free(s->queues);
+  free(s);
+}
+
+// Give producer home's queue fresh slots first touched by the calling
+// thread, so a pinned producer's queue lives on its own NUMA node
+// Only the owning producer may call this, before its first put
+void steal_attach(StealQueues * s, int home)
+{
+  StealQueue * q = &s->queues[home % s->nqueues];
+  size_t bytes = (sizeof(Matrix *) * q->capacity + CACHE_LINE_SIZE - 1) & ~(size_t) (CACHE_LINE_SIZE - 1);
+  Matrix ** items = (Matrix **) aligned_alloc(CACHE_LINE_SIZE, bytes);
+  assert(items != 0);
+  memset(items, 0, bytes);
+  free(q->items);
+  q->items = items; // published to consumers by the release store of bottom
+}
+
+// Append up to n matrices to the owner's queue, returns how many fit
+// Only the owning producer may call this
+static int steal_try_put(StealQueue * q, Matrix ** values, int n)
+{
+  size_t b = atomic_load_explicit(&q->bottom, memory_order_relaxed);
+  size_t t = atomic_load_explicit(&q->top, memory_order_acquire); // consumers are done reading slots before top
+  int room = (int) (q->capacity - (b - t));
+  int k = n < room ? n : room;
+  for (int i = 0; i < k; i++)
+    q->items[(b + i) % q->capacity] = values[i];
+  atomic_store_explicit(&q->bottom, b + k, memory_order_release); // publish the new matrices
+  return k;
+}
+
+// Take up to n matrices from the top of a queue, returns how many were taken
+// The slots are read before the CAS; if another consumer got there first the
+// CAS fails and the copies are thrown away.  The owner cannot overwrite the
+// slots while top still equals t, since they count as full until top moves.
+static int steal_try_take(StealQueue * q, Matrix ** values, int n)
+{
+  size_t t = atomic_load_explicit(&q->top, memory_order_acquire);
+  for (;;) {
+    size_t b = atomic_load_explicit(&q->bottom, memory_order_acquire);
+    if (t >= b)
+      return 0; // queue is empty
+    int k = b - t < (size_t) n ? (int) (b - t) : n;
+    for (int i = 0; i < k; i++)
+      values[i] = ((Matrix * volatile *) q->items)[(t + i) % q->capacity];
+    if (atomic_compare_exchange_weak_explicit(&q->top, &t, t + k,
+                                              memory_order_acq_rel, memory_order_acquire))
+      return k;
+  }
+}
+
+static int steal_queue_has_space(StealQueue * q)
+{
+  return atomic_load(&q->bottom) - atomic_load(&q->top) < q->capacity;
+}
+
+static int steal_has_data(StealQueues * s)
+{
+  for (int i = 0; i < s->nqueues; i++)
+    if (atomic_load(&s->queues[i].bottom) != atomic_load(&s->queues[i].top))
+      return 1;
+  return 0;
+}
+
+// Park the owner of q until its queue has space
+// The waiting flag is published before the queue is rechecked so a
+// consumer that takes a matrix and then reads the flag cannot miss us
+static void steal_park_owner(StealQueues * s, StealQueue * q)
+{
+  atomic_store(&q->waiting, 1);
+  atomic_thread_fence(memory_order_seq_cst);
+  pthread_mutex_lock(&s->lock);
+  while (!steal_queue_has_space(q))
+    pthread_cond_wait(&q->notfull, &s->lock);
+  pthread_mutex_unlock(&s->lock);
+  atomic_store(&q->waiting, 0);
+}
+
+// Park a consumer until some queue has data
+static void steal_park_consumer(StealQueues * s)
+{
+  atomic_fetch_add(&s->waiting_consumers, 1);
+  atomic_thread_fence(memory_order_seq_cst);
+  pthread_mutex_lock(&s->lock);
+  while (!steal_has_data(s))
+    pthread_cond_wait(&s->notempty, &s->lock);
+  pthread_mutex_unlock(&s->lock);
+  atomic_fetch_sub(&s->waiting_consumers, 1);
+}
+
+// Wake consumers after n matrices were added: one for a single matrix, all for a batch
+static void steal_unpark_consumers(StealQueues * s, int n)
+{
+  if (n <= 0)
+    return;
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&s->waiting_consumers, memory_order_relaxed) > 0) {
+    pthread_mutex_lock(&s->lock);
+    if (n > 1)
+      pthread_cond_broadcast(&s->notempty);
+    else
+      pthread_cond_signal(&s->notempty);
+    pthread_mutex_unlock(&s->lock);
+  }
+}
+
+// Wake the owner of q after matrices were taken from it
+static void steal_unpark_owner(StealQueues * s, StealQueue * q)
+{
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&q->waiting, memory_order_relaxed)) {
+    pthread_mutex_lock(&s->lock);
+    pthread_cond_signal(&q->notfull);
+    pthread_mutex_unlock(&s->lock);
+  }
+}
+
+// put n matrices into producer home's queue, blocking while it is full
+// consumers are woken once for the whole batch, or early if we have to park
+void steal_put_many(StealQueues * s, int home, Matrix ** values, int n)
+{
+  StealQueue * q = &s->queues[home % s->nqueues];
+  int done = 0;
+  int woken = 0; // items other threads have been told about
+  int spins = 0;
+  while (done < n) {
+    int k = steal_try_put(q, values + done, n - done);
+    if (k > 0) {
+      done += k;
+      spins = 0;
+    }
+    else if (++spins < STEAL_SPIN_LIMIT)
+      steal_relax();
+    else {
+      steal_unpark_consumers(s, done - woken); // don't sleep on data nobody was told about
+      woken = done;
+      INSTR_TIME(wait_empty_ns, steal_park_owner(s, q));
+      spins = 0;
+    }
+  }
+  steal_unpark_consumers(s, n - woken); // queue has data
+}
+
+// get n matrices, from consumer home's queue first and then from the others
+// blocking while every queue is empty
+void steal_get_many(StealQueues * s, int home, Matrix ** values, int n)
+{
+  int done = 0;
+  int spins = 0;
+  home %= s->nqueues;
+  while (done < n) {
+    int k = 0;
+    for (int i = 0; i < s->nqueues && k == 0; i++) {
+      StealQueue * q = &s->queues[(home + i) % s->nqueues];
+      if ((k = steal_try_take(q, values + done, n - done)) > 0)
+        steal_unpark_owner(s, q); // its producer may be waiting for the space
+    }
+    if (k > 0) {
+      done += k;
+      spins = 0;
+    }
+    else if (++spins < STEAL_SPIN_LIMIT)
+      steal_relax();
+    else {
+      INSTR_TIME(wait_full_ns, steal_park_consumer(s));
+      spins = 0;
+    }
+  }
+}
+
+// approximate number of matrices in all the queues
+int steal_count(StealQueues * s)
+{
+  int count = 0;
+  for (int i = 0; i < s->nqueues; i++) {
+    size_t b = atomic_load_explicit(&s->queues[i].bottom, memory_order_relaxed);
+    size_t t = atomic_load_explicit(&s->queues[i].top, memory_order_relaxed);
+    count += b > t ? (int) (b - t) : 0;
+  }
+  return count;
+}
+
+// number of producers parked on a full queue
+int steal_waiting_producers(StealQueues * s)
+{
+  int waiting = 0;
+  for (int i = 0; i < s->nqueues; i++)
+    waiting += atomic_load_explicit(&s->queues[i].waiting, memory_order_relaxed);
+  return waiting;
+}
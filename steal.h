@@ -0,0 +1,49 @@
+/*
+ *  steal header
+ *  Function prototypes, data, and constants for the work-stealing queues module
+ *
+ *  University of Washington, Tacoma
+ *  TCSS 422 - Operating Systems
+ */
+
+// PER-PRODUCER WORK-STEALING QUEUES
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+// Number of failed attempts a thread spins on the queues before parking
+#define STEAL_SPIN_LIMIT 128
+
+// One producer's queue
+// Only the owning producer advances bottom; consumers take from top with a CAS,
+// from their home queue first and from the others when it is empty
+// top      - next matrix to take
+// bottom   - next free slot
+// waiting  - 1 while the owner is parked on notfull
+typedef struct steal_queue {
+  _Atomic size_t top __attribute__((aligned(CACHE_LINE_SIZE)));
+  _Atomic size_t bottom __attribute__((aligned(CACHE_LINE_SIZE)));
+  Matrix ** items __attribute__((aligned(CACHE_LINE_SIZE)));
+  size_t capacity;
+  _Atomic int waiting;
+  pthread_cond_t notfull;
+} StealQueue;
+
+// All the queues, plus the parking lot shared by every queue
+typedef struct steal_queues {
+  int nqueues;
+  StealQueue * queues;
+  _Atomic int waiting_consumers; // consumers parked on notempty
+  pthread_mutex_t lock;
+  pthread_cond_t notempty;
+} StealQueues;
+
+// steal queue methods
+StealQueues * steal_create(int nqueues, int capacity);
+void steal_destroy(StealQueues * s);
+void steal_attach(StealQueues * s, int home);
+void steal_put_many(StealQueues * s, int home, Matrix ** values, int n);
+void steal_get_many(StealQueues * s, int home, Matrix ** values, int n);
+int steal_count(StealQueues * s);
+int steal_waiting_producers(StealQueues * s);